@@ -6,13 +6,25 @@
 #define SILICON_ASTAR_H
 
 #include <algorithm>
-#include <unordered_map>
+#include <atomic>
+#include <limits>
 #include <queue>
+#include <stdint.h>
+#include <vector>
 #include <assert.h>
 #include "ece556.h"
 
 #define OVERFLOW_EXPENSE 10;
 
+// How the A* frontier is ordered. Pick one at compile time with
+// -DFRONTIER=... (or `make FRONTIER=...`).
+#define FRONTIER_HEAP   0 // std::priority_queue
+#define FRONTIER_BUCKET 1 // one bucket per f value, popped in increasing order
+
+#ifndef FRONTIER
+#define FRONTIER FRONTIER_BUCKET
+#endif
+
 struct AStarFrontierRecord {
     Point parent;
     Point self;
@@ -35,32 +47,297 @@ struct AStarFrontierRecord {
 
 struct AStarDomainRecord {
     Point parent;
-#ifndef NDEBUG
-    int cost;
-#endif
+    int cost; // bidirectional search needs it to know where the two halves meet
 
     AStarDomainRecord() {}
 
     AStarDomainRecord(const AStarFrontierRecord &record)
-            : parent(record.parent)
-#ifndef NDEBUG
-            , cost(record.cost)
-#endif
+            : parent(record.parent), cost(record.cost)
     {}
 };
 
-// For std::unordered_map<Point, ...>
-namespace std {
-    template<>
-    struct hash<Point> {
-        inline size_t operator()(const Point &p) const {
-            return hash<int>()(p.x) ^ hash<int>()(p.y);
+/**
+ * The explored points of a search, as a flat array over the rectangle it's
+ * confined to. Each slot is stamped with the search that wrote it, so
+ * starting a new search is just bumping the epoch; the array only grows,
+ * and is only cleared when the epoch wraps around. Keep one per thread and
+ * reuse it (see thread_workspace).
+ */
+class AStarDomain {
+public:
+    // Forgets everything and covers the points in [tl, br)
+    inline void reset(const Point &tl, const Point &br) {
+        left = tl.x;
+        top = tl.y;
+        width = br.x - tl.x;
+        size_t needed = size_t(width) * size_t(br.y - tl.y);
+        if (slots.size() < needed) slots.resize(needed);
+
+        if (++epoch == 0) {
+            for (Slot &slot : slots) slot.epoch = 0;
+            epoch = 1;
         }
+    }
+
+    inline bool contains(const Point &p) const {
+        return slots[slot(p)].epoch == epoch;
+    }
+    inline const AStarDomainRecord &operator[](const Point &p) const {
+        assert(contains(p));
+        return slots[slot(p)].record;
+    }
+    inline void emplace(const Point &p, const AStarFrontierRecord &record) {
+        Slot &s = slots[slot(p)];
+        s.epoch = epoch;
+        s.record = AStarDomainRecord(record);
+    }
+
+    inline size_t bytes() const {
+        return slots.capacity() * sizeof(Slot);
+    }
+
+private:
+    struct Slot {
+        uint32_t epoch = 0; // never the current epoch until written
+        AStarDomainRecord record;
     };
+
+    inline size_t slot(const Point &p) const {
+        return size_t(p.y - top) * size_t(width) + size_t(p.x - left);
+    }
+
+    std::vector<Slot> slots;
+    uint32_t epoch = 0;
+    int left = 0, top = 0, width = 0;
+};
+
+#if FRONTIER == FRONTIER_HEAP
+// A heap that keeps its storage when cleared
+struct Frontier : std::priority_queue<AStarFrontierRecord> {
+    inline void clear() {
+        c.clear();
+    }
+
+    inline size_t bytes() const {
+        return c.capacity() * sizeof(AStarFrontierRecord);
+    }
+
+    static inline const char *name() {
+        return "heap";
+    }
+};
+#else
+/**
+ * Dial's bucket queue. Edge costs are positive integers and the Manhattan
+ * heuristic never drops by more than one per edge, so f never decreases
+ * from one pop to the next and the buckets can be drained in order with a
+ * cursor. (TreeSearch adds sources mid-search, which can go below it; the
+ * cursor just moves back.) Records with equal f come out last in, first
+ * out, which favours the deepest of them. Buckets keep their storage
+ * across clear().
+ */
+class Frontier {
+public:
+    inline bool empty() const {
+        return count == 0;
+    }
+    inline size_t size() const {
+        return count;
+    }
+
+    inline const AStarFrontierRecord &top() {
+        advance();
+        return buckets[cursor].back();
+    }
+    inline void pop() {
+        advance();
+        buckets[cursor].pop_back();
+        count--;
+    }
+
+    template<typename... Args>
+    inline void emplace(Args &&... args) {
+        AStarFrontierRecord record(std::forward<Args>(args)...);
+        size_t f = size_t(record.hcost);
+        if (f >= buckets.size()) buckets.resize(std::max(f + 1, buckets.size() * 2));
+        buckets[f].push_back(record);
+        cursor = std::min(cursor, f);
+        highest = std::max(highest, f);
+        count++;
+    }
+
+    inline void clear() {
+        for (size_t f = cursor; f <= highest && f < buckets.size(); f++) {
+            buckets[f].clear();
+        }
+        cursor = 0;
+        highest = 0;
+        count = 0;
+    }
+
+    inline size_t bytes() const {
+        size_t bytes = buckets.capacity() * sizeof(buckets[0]);
+        for (const auto &bucket : buckets) {
+            bytes += bucket.capacity() * sizeof(AStarFrontierRecord);
+        }
+        return bytes;
+    }
+
+    static inline const char *name() {
+        return "bucket";
+    }
+
+private:
+    inline void advance() {
+        assert(count > 0);
+        while (buckets[cursor].empty()) cursor++;
+    }
+
+    std::vector<std::vector<AStarFrontierRecord>> buckets; // by f
+    size_t cursor = 0;  // every bucket before this is empty
+    size_t highest = 0; // no bucket after this has anything in it
+    size_t count = 0;
+};
+#endif
+
+/**
+ * The unconnected pins of a net being routed by TreeSearch. Each point of
+ * the search box has a flag, so checking for a pin is one load, and the
+ * pins are also bucketed into BUCKET x BUCKET squares for the distance to
+ * the nearest one: a few pins are just scanned, otherwise the squares are
+ * visited in rings around the point until no closer pin can be left.
+ */
+class PinIndex {
+public:
+    // Forgets every pin and covers the points in [tl, br)
+    inline void reset(const Point &tl, const Point &br) {
+        for (const Point &p : pins) {
+            flags[flag(p)] = 0;
+            buckets[bucket(p)].clear();
+        }
+        pins.clear();
+
+        left = tl.x;
+        top = tl.y;
+        width = br.x - tl.x;
+        cols = (width + BUCKET - 1) / BUCKET;
+        rows = (br.y - tl.y + BUCKET - 1) / BUCKET;
+        size_t needed = size_t(width) * size_t(br.y - tl.y);
+        if (flags.size() < needed) flags.resize(needed, 0);
+        if (buckets.size() < size_t(cols) * rows) buckets.resize(size_t(cols) * rows);
+    }
+
+    inline bool contains(const Point &p) const {
+        return flags[flag(p)] != 0;
+    }
+    inline int size() const {
+        return int(pins.size());
+    }
+
+    inline void add(const Point &p) {
+        assert(!contains(p));
+        flags[flag(p)] = 1;
+        pins.push_back(p);
+        buckets[bucket(p)].push_back(p);
+    }
+    inline void remove(const Point &p) {
+        assert(contains(p));
+        flags[flag(p)] = 0;
+        erase(pins, p);
+        erase(buckets[bucket(p)], p);
+    }
+
+    // Manhattan distance from p to the nearest pin; there must be one
+    inline int distance(const Point &p) const {
+        assert(!pins.empty());
+        int best = std::numeric_limits<int>::max();
+        if (pins.size() <= SCAN) {
+            for (const Point &pin : pins) best = std::min(best, manhattan(p, pin));
+            return best;
+        }
+
+        int bx = (p.x - left) / BUCKET, by = (p.y - top) / BUCKET;
+        int rings = std::max(std::max(bx, cols - 1 - bx), std::max(by, rows - 1 - by));
+        // a pin r rings out is at least (r-1)*BUCKET + 1 away
+        for (int r = 0; r <= rings && (r == 0 || best > (r - 1) * BUCKET + 1); r++) {
+            for (int y = std::max(by - r, 0); y <= std::min(by + r, rows - 1); y++) {
+                int step = (y == by - r || y == by + r) ? 1 : 2 * r;
+                for (int x = bx - r; x <= bx + r; x += step) {
+                    if (x < 0 || x >= cols) continue;
+                    for (const Point &pin : buckets[size_t(y) * cols + x]) best = std::min(best, manhattan(p, pin));
+                }
+            }
+        }
+        return best;
+    }
+
+    inline size_t bytes() const {
+        size_t bytes = flags.capacity() + buckets.capacity() * sizeof(buckets[0]) + pins.capacity() * sizeof(Point);
+        for (const auto &b : buckets) bytes += b.capacity() * sizeof(Point);
+        return bytes;
+    }
+
+private:
+    static const int BUCKET = 8;
+    static const size_t SCAN = 16; // pins the distance just scans
+
+    static inline int manhattan(const Point &a, const Point &b) {
+        return abs(a.x-b.x) + abs(a.y-b.y);
+    }
+    static inline void erase(std::vector<Point> &v, const Point &p) {
+        auto it = std::find(v.begin(), v.end(), p);
+        *it = v.back();
+        v.pop_back();
+    }
+
+    inline size_t flag(const Point &p) const {
+        return size_t(p.y - top) * size_t(width) + size_t(p.x - left);
+    }
+    inline size_t bucket(const Point &p) const {
+        return size_t((p.y - top) / BUCKET) * size_t(cols) + size_t((p.x - left) / BUCKET);
+    }
+
+    std::vector<char> flags;                 // by point, every one 0 unless it's in pins
+    std::vector<std::vector<Point>> buckets; // by square, row major
+    std::vector<Point> pins;
+    int left = 0, top = 0, width = 0, cols = 0, rows = 0;
+};
+
+// Everything a search needs, kept between searches so they don't allocate
+struct AStarWorkspace {
+    AStarDomain explored;
+    Frontier frontier;
+    PinIndex pins; // only TreeSearch uses it
+};
+
+// The calling thread's workspaces; bidirectional search needs two
+inline AStarWorkspace &thread_workspace(int which = 0) {
+    thread_local AStarWorkspace workspaces[2];
+    return workspaces[which];
 }
 
-typedef std::unordered_map<Point, AStarDomainRecord> Domain;
-typedef std::priority_queue<AStarFrontierRecord> Frontier;
+// What the searches did, and the memory of the biggest one since
+// reportMemory last asked. Searches on any thread may record.
+struct AStarStats {
+    std::atomic<size_t> peak_bytes{0}; /* explored domain plus the frontier's storage */
+    std::atomic<long long> searches{0};
+    std::atomic<long long> pushes{0};  /* onto the frontier */
+    std::atomic<long long> pops{0};
+
+    static inline AStarStats &get() {
+        static AStarStats stats;
+        return stats;
+    }
+
+    static inline void record(size_t bytes, long long pushes, long long pops) {
+        AStarStats &stats = get();
+        size_t peak = stats.peak_bytes.load(std::memory_order_relaxed);
+        while (bytes > peak && !stats.peak_bytes.compare_exchange_weak(peak, bytes, std::memory_order_relaxed)) {}
+        stats.searches.fetch_add(1, std::memory_order_relaxed);
+        stats.pushes.fetch_add(pushes, std::memory_order_relaxed);
+        stats.pops.fetch_add(pops, std::memory_order_relaxed);
+    }
+};
 
 inline int default_cost(const RoutingInst &inst, int edge) {
     int newcost = inst.util(edge) + 1;
@@ -71,26 +348,25 @@ inline int default_cost(const RoutingInst &inst, int edge) {
 
 // H(Point) is a lambda which returns the heuristic value h(x) for a point x.
 // G(Point) is a lambda which returns true iff the given point is a goal point.
+// explored must be reset to cover every point valid() accepts.
 // Returns the cost of the solution
 template<typename H, typename G, typename V, typename C>
-inline int AStar(const RoutingInst &inst, Frontier &frontier, std::vector<Point> &path, H heuristic, G is_goal, V valid, C cost, int estimate) {
+inline int AStar(const RoutingInst &inst, Frontier &frontier, AStarDomain &explored, std::vector<Point> &path, H heuristic, G is_goal, V valid, C cost) {
     assert(path.empty());
-    long worstNodes = estimate * estimate;
-
-    Domain explored;
-    explored.reserve(worstNodes);
+    long long pushes = (long long)frontier.size(), pops = 0;
 
     while(!frontier.empty()) {
 
         const AStarFrontierRecord current = frontier.top();
 
         if (is_goal(current.self)) {
+            AStarStats::record(explored.bytes() + frontier.bytes(), pushes, pops);
+
             // backtrace to beginning
             path.push_back(current.self);
             Point p = current.parent;
             while(p.x >= 0) {
                 path.push_back(p);
-                assert(explored.find(p) != explored.end());
                 p = explored[p].parent;
             }
             std::reverse(path.begin(), path.end());
@@ -98,10 +374,10 @@ inline int AStar(const RoutingInst &inst, Frontier &frontier, std::vector<Point>
         }
 
         frontier.pop();
+        pops++;
 
-        auto check_repeat = explored.find(current.self);
-        if (check_repeat != explored.end()) {
-            assert(check_repeat->second.cost <= current.cost);
+        if (explored.contains(current.self)) {
+            assert(explored[current.self].cost <= current.cost);
             continue;
         }
         explored.emplace(current.self, current);
@@ -122,12 +398,12 @@ inline int AStar(const RoutingInst &inst, Frontier &frontier, std::vector<Point>
             int newcost = cost(edge);
 
             int total_cost = current.cost + newcost;
-            auto it = explored.find(child);
-            if (it != explored.end()) {
-                assert(it->second.cost <= total_cost);
+            if (explored.contains(child)) {
+                assert(explored[child].cost <= total_cost);
                 return;
             }
             frontier.emplace(current.self, child, total_cost, heuristic(child));
+            pushes++;
         };
 
         astar_add_child(right_pt, right);
@@ -143,19 +419,256 @@ inline int maze_route_p2p(const RoutingInst &inst, const Net &net, const Point &
     assert(inst.valid(start));
     assert(inst.valid(end));
 
-    Frontier frontier;
+    AStarWorkspace &workspace = thread_workspace();
+    Frontier &frontier = workspace.frontier;
+    frontier.clear();
     frontier.emplace(Point{-1,-1}, start, 0, 0); // heuristic cost doesn't matter here because we pop immediately
-    return AStar(inst, frontier, path,
+    workspace.explored.reset(tl, br);
+    return AStar(inst, frontier, workspace.explored, path,
                  [end](const Point p) -> int  {return abs(p.x-end.x) + abs(p.y-end.y);},
                  [end](const Point p) -> bool {return p == end;},
                  [tl, br](const Point p) -> bool {return p.x >= tl.x && p.y >= tl.y && p.x < br.x && p.y < br.y;},
                  [&inst, &net](const int e) -> int {
-                     if (net.routed_edges.find(e) != net.routed_edges.end()) {
+                     if (net.routed_edges.contains(e)) {
                          return 1; // just wirelength, no overflow cost
                      }
                      return default_cost(inst, e);
-                 },
-                 abs(start.x - end.x) + abs(start.y - end.y));
+                 });
+}
+
+/**
+ * Grows a net's Steiner tree from its first pin, one pin at a time (see
+ * plan_net): every connect() finds the cheapest path from the tree to the
+ * nearest pin that isn't on it yet. The search isn't started over for each
+ * pin. The points of a new path join the sources at cost 0 and reopen the
+ * points they bring closer, while entries whose nearest pin was connected
+ * are put back with their new f when they come up, so each connection only
+ * redoes the part of the search the new path changed.
+ */
+class TreeSearch {
+public:
+    TreeSearch(const RoutingInst &inst, const Net &net, const Point &tl, const Point &br)
+            : inst(inst), tl(tl), br(br), workspace(thread_workspace()), pins(workspace.pins) {
+        workspace.frontier.clear();
+        workspace.explored.reset(tl, br);
+        pins.reset(tl, br);
+        const Point &first = net.pins[0];
+        for (int p = 1; p < net.numPins; p++) {
+            const Point &pin = net.pins[p];
+            assert(valid(pin));
+            if (pin != first && !pins.contains(pin)) pins.add(pin);
+        }
+        if (!done()) add_source(first);
+    }
+
+    inline bool done() const {
+        return pins.size() == 0;
+    }
+
+    // path runs from a tree point to the pin it reaches, which joins the tree
+    // along with the rest of the path (and any other pins on it)
+    inline int connect(std::vector<Point> &path) {
+        assert(path.empty());
+        assert(!done());
+        Frontier &frontier = workspace.frontier;
+        AStarDomain &explored = workspace.explored;
+        long long pops = 0;
+
+        while (true) {
+            assert(!frontier.empty());
+            const AStarFrontierRecord current = frontier.top();
+            frontier.pop();
+            pops++;
+
+            int h = pins.distance(current.self);
+            if (current.hcost < current.cost + h) { // its nearest pin was connected
+                frontier.emplace(current.parent, current.self, current.cost, h);
+                pushes++;
+                continue;
+            }
+            if (explored.contains(current.self) && explored[current.self].cost <= current.cost) continue;
+
+            if (pins.contains(current.self)) {
+                path.push_back(current.self);
+                for (Point p = current.parent; p.x >= 0; p = explored[p].parent) {
+                    path.push_back(p);
+                }
+                std::reverse(path.begin(), path.end());
+                AStarStats::record(explored.bytes() + frontier.bytes() + pins.bytes(), pushes, pops);
+                pushes = 0;
+
+                for (const Point &p : path) {
+                    if (pins.contains(p)) pins.remove(p);
+                }
+                if (!done()) {
+                    for (size_t c = 1; c < path.size(); c++) add_source(path[c]);
+                }
+                return current.cost;
+            }
+            explored.emplace(current.self, current);
+
+            auto add_child = [&](const Point &child, int edge) {
+                if (child == current.parent || !valid(child)) return;
+                int total_cost = current.cost + default_cost(inst, edge);
+                if (explored.contains(child) && explored[child].cost <= total_cost) return;
+                frontier.emplace(current.self, child, total_cost, pins.distance(child));
+                pushes++;
+            };
+            const Point &self = current.self;
+            add_child(Point{self.x+1, self.y  }, inst.edge_index(self.x  , self.y  , true ));
+            add_child(Point{self.x  , self.y+1}, inst.edge_index(self.x  , self.y  , false));
+            add_child(Point{self.x-1, self.y  }, inst.edge_index(self.x-1, self.y  , true ));
+            add_child(Point{self.x  , self.y-1}, inst.edge_index(self.x  , self.y-1, false));
+        }
+    }
+
+private:
+    inline bool valid(const Point &p) const {
+        return p.x >= tl.x && p.y >= tl.y && p.x < br.x && p.y < br.y;
+    }
+    inline void add_source(const Point &p) {
+        workspace.frontier.emplace(Point{-1,-1}, p, 0, pins.distance(p));
+        pushes++;
+    }
+
+    const RoutingInst &inst;
+    Point tl, br;
+    AStarWorkspace &workspace;
+    PinIndex &pins;
+    long long pushes = 0; // since the last connection was recorded
+};
+
+// Where the forward and backward searches of BidirectionalAStar join: the
+// forward search reached fwd, the backward one bwd, and they're either the
+// same point or the two ends of one edge.
+struct AStarMeeting {
+    int cost = std::numeric_limits<int>::max();
+    Point fwd, bwd;
+};
+
+// Expands the best point of one side of a bidirectional search, noting
+// every place it touches the points the other side has already explored.
+template<typename P, typename V, typename C>
+inline void bidirectional_expand(const RoutingInst &inst, AStarWorkspace &side, const AStarWorkspace &other, bool forward,
+                                 AStarMeeting &meeting, long long &pushes, P potential, V valid, C cost) {
+    const AStarFrontierRecord current = side.frontier.top();
+    side.frontier.pop();
+    if (side.explored.contains(current.self)) {
+        assert(side.explored[current.self].cost <= current.cost);
+        return;
+    }
+    side.explored.emplace(current.self, current);
+
+    auto meet = [&](const Point &mine, const Point &theirs, int total) {
+        if (total >= meeting.cost) return;
+        meeting.cost = total;
+        meeting.fwd = forward ? mine : theirs;
+        meeting.bwd = forward ? theirs : mine;
+    };
+    if (other.explored.contains(current.self)) {
+        meet(current.self, current.self, current.cost + other.explored[current.self].cost);
+    }
+
+    auto add_child = [&](Point child, int edge) {
+        if (child == current.parent) return;
+        if (!valid(child)) return;
+
+        int total_cost = current.cost + cost(edge);
+        if (other.explored.contains(child)) {
+            meet(current.self, child, total_cost + other.explored[child].cost);
+        }
+        if (side.explored.contains(child)) {
+            assert(side.explored[child].cost <= total_cost);
+            return;
+        }
+        side.frontier.emplace(current.self, child, total_cost, total_cost + potential(child));
+        pushes++;
+    };
+
+    Point self = current.self;
+    add_child(Point{self.x+1, self.y  }, inst.edge_index(self.x  , self.y  , true ));
+    add_child(Point{self.x  , self.y+1}, inst.edge_index(self.x  , self.y  , false));
+    add_child(Point{self.x-1, self.y  }, inst.edge_index(self.x-1, self.y  , true ));
+    add_child(Point{self.x  , self.y-1}, inst.edge_index(self.x  , self.y-1, false));
+}
+
+/**
+ * A* from both ends at once, for edge costs of at least one that don't
+ * depend on direction. hf and hb are consistent heuristics towards end
+ * and start. Searching each way with its own heuristic (Pohl's version)
+ * ends up with both sides running most of a full search, so instead both
+ * use the average of the two: forward f is 2g + hf - hb, backward f is
+ * 2g + hb - hf, both offset by distance, the start-to-end distance, to stay
+ * non-negative. Those potentials are still consistent (hf - hb changes by
+ * at most 2 per edge), so the frontiers pop in order, and the two f of any
+ * point add up to twice the cost of the best path through it plus twice
+ * distance. The search stops once the best f of both frontiers together
+ * can't beat the cheapest path through a point (or edge) both sides have
+ * explored, so it's as optimal as AStar. Each step expands the side with
+ * the smaller frontier.
+ * fwd and bwd must be reset to cover every point valid() accepts and hold
+ * their start points, keyed that way.
+ * Returns the cost of the solution
+ */
+template<typename HF, typename HB, typename V, typename C>
+inline int BidirectionalAStar(const RoutingInst &inst, AStarWorkspace &fwd, AStarWorkspace &bwd, std::vector<Point> &path,
+                              HF hf, HB hb, int distance, V valid, C cost) {
+    assert(path.empty());
+    long long pushes = (long long)(fwd.frontier.size() + bwd.frontier.size()), pops = 0;
+
+    auto forward_potential  = [&](const Point p) -> int {return hf(p) - hb(p) + distance;};
+    auto backward_potential = [&](const Point p) -> int {return hb(p) - hf(p) + distance;};
+
+    AStarMeeting meeting;
+    while (!fwd.frontier.empty() && !bwd.frontier.empty()) {
+        long long best = (long long)fwd.frontier.top().hcost + bwd.frontier.top().hcost;
+        if (best >= 2 * ((long long)meeting.cost + distance)) break;
+
+        pops++;
+        if (fwd.frontier.size() <= bwd.frontier.size())
+            bidirectional_expand(inst, fwd, bwd, true, meeting, pushes, forward_potential, valid, cost);
+        else
+            bidirectional_expand(inst, bwd, fwd, false, meeting, pushes, backward_potential, valid, cost);
+    }
+    assert(meeting.cost != std::numeric_limits<int>::max());
+    AStarStats::record(fwd.explored.bytes() + fwd.frontier.bytes() + bwd.explored.bytes() + bwd.frontier.bytes(), pushes, pops);
+
+    // the forward half backwards, then the backward half
+    for (Point p = meeting.fwd; p.x >= 0; p = fwd.explored[p].parent) {
+        path.push_back(p);
+    }
+    std::reverse(path.begin(), path.end());
+    // when both halves end on the same point it is already on the path
+    Point from = meeting.bwd == meeting.fwd ? bwd.explored[meeting.bwd].parent : meeting.bwd;
+    for (Point p = from; p.x >= 0; p = bwd.explored[p].parent) {
+        path.push_back(p);
+    }
+    return meeting.cost;
+}
+
+// maze_route_p2p, searching from start and end at once
+inline int maze_route_p2p_bidirectional(const RoutingInst &inst, const Net &net, const Point &start, const Point &end, const Point &tl, const Point &br, std::vector<Point> &path) {
+    assert(inst.valid(start));
+    assert(inst.valid(end));
+
+    AStarWorkspace &fwd = thread_workspace(0), &bwd = thread_workspace(1);
+    auto to_end   = [end]  (const Point p) -> int {return abs(p.x-end.x)   + abs(p.y-end.y);};
+    auto to_start = [start](const Point p) -> int {return abs(p.x-start.x) + abs(p.y-start.y);};
+    fwd.frontier.clear();
+    bwd.frontier.clear();
+    int distance = to_end(start);
+    fwd.frontier.emplace(Point{-1,-1}, start, 0, 2 * distance); // hf - hb + distance at start
+    bwd.frontier.emplace(Point{-1,-1}, end, 0, 2 * distance);
+    fwd.explored.reset(tl, br);
+    bwd.explored.reset(tl, br);
+    return BidirectionalAStar(inst, fwd, bwd, path, to_end, to_start, distance,
+                              [tl, br](const Point p) -> bool {return p.x >= tl.x && p.y >= tl.y && p.x < br.x && p.y < br.y;},
+                              [&inst, &net](const int e) -> int {
+                                  if (net.routed_edges.contains(e)) {
+                                      return 1; // just wirelength, no overflow cost
+                                  }
+                                  return default_cost(inst, e);
+                              });
 }
 
 #endif //SILICON_ASTAR_H
@@ -1,14 +1,27 @@
 // ECE556 - Copyright 2014 University of Wisconsin-Madison.  All Rights Reserved.
 
 #include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <list>
+#include <string.h>
 #include <string>
 #include <sstream>
+#include <fstream>
 #include <vector>
+#include <zlib.h>
 
 #include "ece556.h"
 #include "astar.h"
 #include "svg.h"
+#include "mapped_file.h"
+#include "memory_usage.h"
+#include "parallel.h"
+#include "perf_counter.h"
 
 extern "C" {
     #include <flute/flute.h>
@@ -22,6 +35,7 @@ using std::string;
 using std::vector;
 using std::getline;
 using std::istream;
+using std::ifstream;
 using std::ostream;
 using std::stringstream;
 using std::cout;
@@ -37,156 +51,467 @@ const bool useCongestionAwareInitial = true;
 const bool useCongestionAwareTreeGen = true;
 
 
+// ------------------------- FLUTE tables --------------------------------
+
+// FLUTE's lookup tables don't depend on the benchmark, so they load on their
+// own thread while the benchmark is read. Only touched from the main thread.
+// (The thread is never destroyed: exit() would terminate on a joinable one.)
+static std::thread *fluteLoader = nullptr;
+static bool fluteLoaded = false;
+
+void startLoadingFlute() {
+    if (fluteLoader != nullptr || fluteLoaded) return;
+    fluteLoader = new std::thread(readLUT);
+}
+
+// Call before any flute() call
+void waitForFlute() {
+    if (fluteLoaded) return;
+    if (fluteLoader != nullptr) {
+        fluteLoader->join();
+    } else {
+        readLUT();
+    }
+    fluteLoaded = true;
+}
+
+
 // ------------------------- readBenchmark --------------------------------
 
+void fail(const char *msg) {
+    cerr << "ERROR: " << msg << endl;
+    exit(1);
+}
+
 void setup_routing_inst(RoutingInst &inst, int gx, int gy, int cap, int nets) {
+    if (cap > EdgeState::MAX_VCAP)
+        return fail("Capacity doesn't fit in the edge counters, rebuild with EDGE_COUNTER_BITS=32");
+
     // set up fields
     inst.gx = gx;
     inst.gy = gy;
     inst.cap = cap;
     inst.numNets = nets;
     inst.numCells = gx*gy;
+    inst.grid.resize(gx, gy);
 
     inst.nets = new Net[nets];
-    inst.utilization = new Cell[gx*gy];
-    inst.virtual_cap = new Cell[gx*gy];
-
-    for (int c = 0; c < gx*gy; c++) {
-        inst.virtual_cap[c].right = cap;
-        inst.virtual_cap[c].down = cap;
-    }
+    inst.edges.resize(2*inst.grid.size(), cap);
+    inst.edge_nets.resize(2*inst.grid.size());
 }
 
 inline void apply_blockage(RoutingInst &inst, int x, int y, int ex, int ey, int new_cap) {
     if (x == ex) { // vertical
         for (; y < ey; y++) {
-            inst.util(x, y).down = inst.cap - new_cap;
+            inst.edges.set_util(inst.edge_index(x, y, false), inst.cap - new_cap);
         }
     } else {
         assert(y == ey);
         for (; x < ex; x++) {
-            inst.util(x, y).right = inst.cap - new_cap;
+            inst.edges.set_util(inst.edge_index(x, y, true), inst.cap - new_cap);
         }
     }
 }
 
-void fail(const char *msg) {
-    cerr << "ERROR: " << msg << endl;
-    exit(1);
+
+inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
 }
 
-void readBenchmark(istream &in, RoutingInst &rst) {
-    if (!in) return fail("Bad input file");
+// Hand-rolled replacement for a stringstream over the current line.
+// Accepts exactly what `line >> token` and `line >> int` used to.
+struct Tokenizer {
+    const char *cur = nullptr; // read position in the current line
+    const char *eol = nullptr; // end of the current line
+
+    inline void skip_space() {
+        while (cur < eol && is_space(*cur)) cur++;
+    }
+
+    // reads the next whitespace-delimited token and checks that it's `expected`
+    inline bool word(const char *expected) {
+        skip_space();
+        const char *start = cur;
+        while (cur < eol && !is_space(*cur)) cur++;
 
+        size_t len = size_t(cur - start);
+        return strlen(expected) == len && memcmp(start, expected, len) == 0;
+    }
+
+    // skips the next token, whatever it is
+    inline void word() {
+        skip_space();
+        while (cur < eol && !is_space(*cur)) cur++;
+    }
+
+    // like istream >> int, sets value to 0 on failure
+    inline bool integer(int &value) {
+        skip_space();
+        const char *p = cur;
+        bool negative = false;
+        if (p < eol && (*p == '-' || *p == '+')) {
+            negative = (*p == '-');
+            p++;
+        }
+        if (p == eol || unsigned(*p - '0') > 9) {
+            value = 0;
+            cur = eol; // a failed extraction poisons the rest of the line
+            return false;
+        }
+
+        int result = 0;
+        do {
+            int digit = *p - '0';
+            if (result > (std::numeric_limits<int>::max() - digit) / 10) fail("Number in the benchmark is too large");
+            result = result * 10 + digit;
+            p++;
+        } while (p < eol && unsigned(*p - '0') <= 9);
+
+        value = negative ? -result : result;
+        cur = p;
+        return true;
+    }
+};
+
+// Lines straight out of a memory-mapped file. No copies, no allocation.
+struct MappedLines : Tokenizer {
+    const char *pos; // start of the next line
+    const char *end; // end of the file
+
+    MappedLines(const char *data, size_t size) : pos(data), end(data + size) {}
+
+    inline bool next_line() {
+        if (pos >= end) return false;
+        cur = pos;
+        eol = static_cast<const char *>(memchr(pos, '\n', size_t(end - pos)));
+        if (eol == nullptr) eol = end;
+        pos = eol + 1;
+        return true;
+    }
+};
+
+// Fallback for inputs that can't be mapped (pipes, etc.)
+struct StreamLines : Tokenizer {
+    istream &in;
     string line;
-    string token;
 
+    StreamLines(istream &in) : in(in) {}
+
+    inline bool next_line() {
+        if (!getline(in, line)) return false;
+        cur = line.data();
+        eol = cur + line.size();
+        return true;
+    }
+};
+
+// Reads the net header, returning its pin count.
+template<typename Lines>
+int read_net_header(Lines &in, Net &net, int n) {
+    if (!in.next_line())    { fail("Couldn't read all the nets"); return 0; }
+    int num_pins = -1;
+    in.word();
+    in.integer(num_pins);
+    if (num_pins <= 0)      { fail("Net had 0 or fewer pins"); return 0; }
+    net.id = n; // TODO: do we actually ever need this?
+    net.numPins = num_pins;
+    net.nroute.numSegs = -1; // TODO: may not need to label this...
+    return num_pins;
+}
+
+template<typename Lines>
+void read_pins(Lines &in, Net &net) {
+    for (int c = 0; c < net.numPins; c++) {
+        if (!in.next_line()) return fail("Couldn't read all net points");
+        in.integer(net.pins[c].x);
+        in.integer(net.pins[c].y);
+    }
+}
+
+void read_nets(StreamLines &in, RoutingInst &rst) {
+    for (int n = 0; n < rst.numNets; n++) {
+        int num_pins = read_net_header(in, rst.nets[n], n);
+        rst.nets[n].pins = rst.pool.alloc<Point>(size_t(num_pins));
+        read_pins(in, rst.nets[n]);
+    }
+}
+
+// Below this many pins it's not worth starting threads
+const long PARALLEL_PARSE_MIN_PINS = 1 << 16;
+
+// Two passes: first a serial scan which parses each net header and skips over
+// its pin lines to find the next one, then the pin lines themselves are parsed
+// in parallel, with each thread taking a contiguous range of nets.
+void read_nets(MappedLines &in, RoutingInst &rst) {
+    vector<const char *> pin_lines(rst.numNets);
+    vector<long> pin_offset(rst.numNets + 1);
+
+    // pass 1: index the nets
+    long total_pins = 0;
+    for (int n = 0; n < rst.numNets; n++) {
+        int num_pins = read_net_header(in, rst.nets[n], n);
+        pin_lines[n] = in.pos;
+        pin_offset[n] = total_pins;
+        total_pins += num_pins;
+
+        for (int c = 0; c < num_pins; c++) {
+            if (!in.next_line()) return fail("Couldn't read all net points");
+        }
+    }
+    pin_offset[rst.numNets] = total_pins;
+
+    // all the pins live in one block, nets point into it
+    Point *pins = rst.pool.alloc<Point>(size_t(total_pins));
+    for (int n = 0; n < rst.numNets; n++) {
+        rst.nets[n].pins = pins + pin_offset[n];
+    }
+
+    // pass 2: split the nets so each thread gets about the same number of pins
+    int threads = total_pins < PARALLEL_PARSE_MIN_PINS ? 1 : hardware_threads();
+    const char *end = in.end;
+    run_threads(threads, [&](int t) {
+        long first_pin = total_pins * t / threads;
+        long last_pin = total_pins * (t+1) / threads;
+        int first = int(std::lower_bound(pin_offset.begin(), pin_offset.end() - 1, first_pin) - pin_offset.begin());
+        int last = int(std::lower_bound(pin_offset.begin(), pin_offset.end() - 1, last_pin) - pin_offset.begin());
+        if (t == threads - 1) last = rst.numNets;
+
+        for (int n = first; n < last; n++) {
+            MappedLines lines(pin_lines[n], size_t(end - pin_lines[n]));
+            read_pins(lines, rst.nets[n]);
+        }
+    });
+}
+
+template<typename Lines>
+void parse_benchmark(Lines &in, RoutingInst &rst) {
     // read the grid size
     int gx = 0, gy = 0;
-    if (!getline(in, line))  return fail("Couldn't read grid size");
-    stringstream grid(line);
-    grid >> token;
-    if (token != "grid")     return fail("Benchmark doesn't start with 'grid'");
-    if (!(grid >> gx >> gy)) return fail("Benchmark doesn't have grid size");
+    if (!in.next_line())     return fail("Couldn't read grid size");
+    if (!in.word("grid"))    return fail("Benchmark doesn't start with 'grid'");
+    if (!(in.integer(gx) && in.integer(gy))) return fail("Benchmark doesn't have grid size");
     if (gx < 0 || gy < 0)    return fail("Invalid grid size!");
 
     // read the capacity
     int capacity = 0;
-    if (!getline(in, line))     return fail("Couldn't read capacity");
-    stringstream capline(line);
-    capline >> token;
-    if (token != "capacity")    return fail("Benchmark line 2 doesn't start with capacity");
-    if (!(capline >> capacity)) return fail("Benchmark doesn't have capacity");
-    if (capacity <= 0)          return fail("Invalid capacity");
+    if (!in.next_line())         return fail("Couldn't read capacity");
+    if (!in.word("capacity"))    return fail("Benchmark line 2 doesn't start with capacity");
+    if (!in.integer(capacity))   return fail("Benchmark doesn't have capacity");
+    if (capacity <= 0)           return fail("Invalid capacity");
 
     // read the number of nets
     int numnets = 0;
-    if (!getline(in, line)) return fail("Couldn't read num nets");
-    stringstream netline(line);
-    netline >> token;
-    if (token != "num")     return fail("Line 3 does not start with 'num'");
-    netline >> token;
-    if (token != "net")     return fail("Line 3 does not start with 'num net'");
-    netline >> numnets;
+    if (!in.next_line())    return fail("Couldn't read num nets");
+    if (!in.word("num"))    return fail("Line 3 does not start with 'num'");
+    if (!in.word("net"))    return fail("Line 3 does not start with 'num net'");
+    in.integer(numnets);
     if (numnets <= 0)       return fail("Bad number of nets");
 
     // allocate buffers
     setup_routing_inst(rst, gx, gy, capacity, numnets);
 
     // read the nets
-    for (int n = 0; n < numnets; n++) {
-        // set up the net
-        if (!getline(in, line)) return fail("Couldn't read all the nets");
-        stringstream netdef(line);
-        int num_pins = -1;
-        netdef >> token >> num_pins;
-        if (num_pins <= 0)      return fail("Net had 0 or fewer pins");
-        rst.nets[n].id = n; // TODO: do we actually ever need this?
-        rst.nets[n].numPins = num_pins;
-        rst.nets[n].pins = new Point[num_pins]; // TODO: Littering the heap, allocate from pool instead
-        rst.nets[n].nroute.numSegs = -1; // TODO: may not need to label this...
-
-        // read the points
-        for (int c = 0; c < num_pins; c++) {
-            if (!getline(in, line)) return fail("Couldn't read all net points");
-            stringstream pindef(line);
-            pindef >> rst.nets[n].pins[c].x >> rst.nets[n].pins[c].y;
-        }
-    }
+    read_nets(in, rst);
 
     // read the blockage metadata
-    if (!getline(in, line)) return fail("Couldn't read blockage count");
-    stringstream blockhead(line);
+    if (!in.next_line()) return fail("Couldn't read blockage count");
     int num_blockages = -1;
-    blockhead >> num_blockages;
+    in.integer(num_blockages);
     if (num_blockages < 0) return fail("Invalid number of blockages");
 
     // read the blockages
     for (int c = 0; c < num_blockages; c++) {
         int x1, y1, x2, y2, new_cap;
-        if (!getline(in, line)) return fail("Couldn't read all blockages");
-        stringstream blockage(line);
-        if (!(blockage >> x1 >> y1 >> x2 >> y2 >> new_cap)) return fail("Invalid blockage");
+        if (!in.next_line()) return fail("Couldn't read all blockages");
+        if (!(in.integer(x1) && in.integer(y1) && in.integer(x2) && in.integer(y2) && in.integer(new_cap)))
+            return fail("Invalid blockage");
         apply_blockage(rst, x1, y1, x2, y2, new_cap);
     }
+}
+
+void readBenchmark(istream &in, RoutingInst &rst) {
+    if (!in) return fail("Bad input file");
+
+    StreamLines lines(in);
+    parse_benchmark(lines, rst);
+}
+
+void readBenchmark(const char *fileName, RoutingInst &rst) {
+    MappedFile file;
+    if (!file.open(fileName)) {
+        // not mappable, go the slow way
+        ifstream in(fileName);
+        return readBenchmark(in, rst);
+    }
 
-    readLUT(); // setup FLUTE
+    MappedLines lines(file.data, file.size);
+    parse_benchmark(lines, rst);
 }
 
+// Binary snapshot of a freshly parsed RoutingInst. Layout:
+//   BenchmarkCacheHeader
+//   int utilization[2*numCells]   (by row-major edge index, blockages already applied)
+//   int64_t pin_offset[numNets+1] (index of each net's first pin)
+//   Point pins[numPins]
+// Everything is 8-byte aligned so it can be used straight out of the map.
+const char BENCHMARK_CACHE_MAGIC[8] = {'S', 'I', 'L', 'I', 'C', 'O', 'N', 0};
+const uint32_t BENCHMARK_CACHE_VERSION = 1;
+
+struct BenchmarkCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+
+    // identifies the benchmark this was made from, so edits invalidate it
+    int64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+
+    int32_t gx, gy, cap, numNets;
+    int64_t numCells;
+    int64_t numPins;
+};
+
+bool stat_source(const char *fileName, BenchmarkCacheHeader &header) {
+    struct stat st;
+    if (stat(fileName, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    header.source_size = st.st_size;
+    header.source_mtime_sec = st.st_mtim.tv_sec;
+    header.source_mtime_nsec = st.st_mtim.tv_nsec;
+    return true;
+}
+
+bool readBenchmarkCache(const char *cacheFileName, const char *sourceFileName, RoutingInst &rst) {
+    BenchmarkCacheHeader source;
+    if (!stat_source(sourceFileName, source)) return false;
+
+    MappedFile file;
+    if (!file.open(cacheFileName, true)) return false;
+    if (file.size < sizeof(BenchmarkCacheHeader)) return false;
+
+    BenchmarkCacheHeader header;
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, BENCHMARK_CACHE_MAGIC, sizeof(header.magic)) != 0) return false;
+    if (header.version != BENCHMARK_CACHE_VERSION) return false;
+    if (header.header_size != sizeof(BenchmarkCacheHeader)) return false;
+    if (header.source_size != source.source_size ||
+        header.source_mtime_sec != source.source_mtime_sec ||
+        header.source_mtime_nsec != source.source_mtime_nsec) return false;
+    if (header.gx < 0 || header.gy < 0 || header.numNets <= 0) return false;
+    if (header.numCells != int64_t(header.gx) * header.gy || header.numPins < 0) return false;
+
+    size_t cells_size   = size_t(header.numCells) * 2 * sizeof(int);
+    size_t offsets_size = size_t(header.numNets + 1) * sizeof(int64_t);
+    size_t pins_size    = size_t(header.numPins) * sizeof(Point);
+    if (file.size != sizeof(header) + cells_size + offsets_size + pins_size) return false;
+
+    const char *cells = file.data + sizeof(header);
+    const int64_t *pin_offset = reinterpret_cast<const int64_t *>(cells + cells_size);
+    Point *pins = reinterpret_cast<Point *>(const_cast<char *>(cells + cells_size + offsets_size));
+    for (int n = 0; n < header.numNets; n++) {
+        if (pin_offset[n+1] <= pin_offset[n]) return false;
+    }
+    if (pin_offset[0] != 0 || pin_offset[header.numNets] != header.numPins) return false;
+
+    setup_routing_inst(rst, header.gx, header.gy, header.cap, header.numNets);
+    const int *utilization = reinterpret_cast<const int *>(cells);
+    for (int e = 0; e < 2*rst.numCells; e++) {
+        rst.edges.set_util(rst.memory_edge(e), utilization[e]);
+    }
+    for (int n = 0; n < header.numNets; n++) {
+        rst.nets[n].id = n;
+        rst.nets[n].numPins = int(pin_offset[n+1] - pin_offset[n]);
+        rst.nets[n].pins = pins + pin_offset[n];
+        rst.nets[n].nroute.numSegs = -1;
+    }
+
+    file.release(); // the pins are used in place
+    return true;
+}
+
+void writeBenchmarkCache(const char *cacheFileName, const char *sourceFileName, const RoutingInst &rst) {
+    BenchmarkCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    if (!stat_source(sourceFileName, header)) {
+        cerr << "WARNING: couldn't write benchmark cache " << cacheFileName << endl;
+        return;
+    }
+
+    memcpy(header.magic, BENCHMARK_CACHE_MAGIC, sizeof(header.magic));
+    header.version = BENCHMARK_CACHE_VERSION;
+    header.header_size = sizeof(BenchmarkCacheHeader);
+    header.gx = rst.gx;
+    header.gy = rst.gy;
+    header.cap = rst.cap;
+    header.numNets = rst.numNets;
+    header.numCells = rst.numCells;
+
+    vector<int64_t> pin_offset(rst.numNets + 1);
+    int64_t total_pins = 0;
+    for (int n = 0; n < rst.numNets; n++) {
+        pin_offset[n] = total_pins;
+        total_pins += rst.nets[n].numPins;
+    }
+    pin_offset[rst.numNets] = total_pins;
+    header.numPins = total_pins;
+
+    // write to a temp file and rename, so a concurrent run never maps half a cache
+    stringstream tmpname;
+    tmpname << cacheFileName << ".tmp" << getpid();
+    string tmp = tmpname.str();
+
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (f == nullptr) {
+        cerr << "WARNING: couldn't write benchmark cache " << cacheFileName << endl;
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    vector<int> utilization(2 * size_t(rst.numCells));
+    for (int e = 0; e < 2*rst.numCells; e++) {
+        utilization[e] = rst.util(rst.memory_edge(e));
+    }
+    ok = ok && fwrite(utilization.data(), sizeof(int), utilization.size(), f) == utilization.size();
+    ok = ok && fwrite(pin_offset.data(), sizeof(int64_t), pin_offset.size(), f) == pin_offset.size();
+    for (int n = 0; ok && n < rst.numNets; n++) {
+        ok = fwrite(rst.nets[n].pins, sizeof(Point), size_t(rst.nets[n].numPins), f) == size_t(rst.nets[n].numPins);
+    }
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok || rename(tmp.c_str(), cacheFileName) != 0) {
+        cerr << "WARNING: couldn't write benchmark cache " << cacheFileName << endl;
+        remove(tmp.c_str());
+    }
+}
 
 
 // ----------------------- Initial Solution ----------------------------
 
 inline void use_edge(RoutingInst &inst, Net &net, int edge) {
-    auto result = net.routed_edges.emplace(edge, 1);
-    if (result.second) {
-        inst.util(edge)++;
-    } else {
-        result.first->second++;
+    int *node = net.routed_edges.add(edge);
+    if (node != nullptr) {
+        inst.edges.add_util(edge, 1);
+        *node = inst.edge_nets.add(edge, net.id);
     }
 }
 
 inline void ripup_edge(RoutingInst &inst, Net &net, int edge) {
-    auto result = net.routed_edges.find(edge);
-    assert(result != net.routed_edges.end());
-
-    result->second--;
-    if (result->second == 0) {
-        net.routed_edges.erase(result);
-        inst.util(edge)--;
+    int node = net.routed_edges.remove(edge);
+    if (node >= 0) {
+        inst.edges.add_util(edge, -1);
+        inst.edge_nets.remove(edge, node);
     }
 }
 
+// The cost of each L between the segment's ends, summing u over its edges
 template<typename Util>
-void L_route(RoutingInst &rst, Net &net, Segment &seg, Util u) {
+void L_costs(const RoutingInst &rst, const Segment &seg, Util u, int &bxpy_cost, int &bypx_cost) {
     int minX = min(seg.p1.x, seg.p2.x);
     int maxX = max(seg.p1.x, seg.p2.x);
     int minY = min(seg.p1.y, seg.p2.y);
     int maxY = max(seg.p1.y, seg.p2.y);
 
-    // calculate cost of each L
-    int bxpy_cost = 0;
-    int bypx_cost = 0;
+    bxpy_cost = 0;
+    bypx_cost = 0;
     for (int x = minX; x < maxX; x++) {
         bxpy_cost += u(rst.edge_index(x, seg.p2.y, true));
         bypx_cost += u(rst.edge_index(x, seg.p1.y, true));
@@ -195,11 +520,22 @@ void L_route(RoutingInst &rst, Net &net, Segment &seg, Util u) {
         bxpy_cost += u(rst.edge_index(seg.p1.x, y, false));
         bypx_cost += u(rst.edge_index(seg.p2.x, y, false));
     }
+}
+
+template<typename Util>
+void L_route(RoutingInst &rst, Net &net, Segment &seg, Util u) {
+    int minX = min(seg.p1.x, seg.p2.x);
+    int maxX = max(seg.p1.x, seg.p2.x);
+    int minY = min(seg.p1.y, seg.p2.y);
+    int maxY = max(seg.p1.y, seg.p2.y);
+
+    // calculate cost of each L
+    int bxpy_cost, bypx_cost;
+    L_costs(rst, seg, u, bxpy_cost, bypx_cost);
 
     // allocate edge indices
-    // TODO: Better allocator.
     int numEdges = seg.numEdges = abs(seg.p1.x-seg.p2.x)+abs(seg.p1.y-seg.p2.y);
-    int *edge = seg.edges = new int[numEdges];
+    int *edge = seg.edges = rst.pool.alloc<int>(size_t(numEdges));
 
     // mark less expensive L
     if (bxpy_cost < bypx_cost) {
@@ -255,12 +591,12 @@ void three_bend_route(RoutingInst &rst, Net &net, Segment &seg) {
         for (int x = 0; x < numX; x++) {
             // Horizonal Cost
             if(x != 0) {
-                cells[x + (numX*y)].right = rst.util(x+minX-1,y+minY).right + cells[x-1 +(numX*y)].right;
+                cells[x + (numX*y)].right = rst.util(rst.edge_index(x+minX-1, y+minY, true)) + cells[x-1 +(numX*y)].right;
             }
 
             // Vertical
             if (y != 0) {
-                cells[x + (numX*y)].down = rst.util(x+minX,y+minY-1).down + cells[x + (numX*(y-1))].down;
+                cells[x + (numX*y)].down = rst.util(rst.edge_index(x+minX, y+minY-1, false)) + cells[x + (numX*(y-1))].down;
             }
         }
     }
@@ -301,7 +637,7 @@ void three_bend_route(RoutingInst &rst, Net &net, Segment &seg) {
     
     int numEdges = seg.numEdges = abs(seg.p1.x-bestX)+abs(seg.p1.y-bestY) +
                                   abs(seg.p2.x-bestX)+abs(seg.p2.y-bestY);
-    int *edge = seg.edges = new int[numEdges];
+    int *edge = seg.edges = rst.pool.alloc<int>(size_t(numEdges));
 
     minX = min(seg.p1.x, bestX);
     maxX = max(seg.p1.x, bestX);
@@ -367,7 +703,7 @@ void routeInitialSolutionShitty(RoutingInst &rst) {
     // just L-route all of the segments
     for (int n = 0; n < rst.numNets; n++) {
         int numSegs = rst.nets[n].numPins - 1;
-        Segment *segments = new Segment[numSegs];
+        Segment *segments = rst.pool.alloc<Segment>(size_t(numSegs));
         rst.nets[n].nroute.numSegs = numSegs;
         rst.nets[n].nroute.segments = segments;
 
@@ -379,27 +715,38 @@ void routeInitialSolutionShitty(RoutingInst &rst) {
     }
 }
 
-void make_segments(Net &net, Tree &tree) {
-    int maxNumCons = tree.deg*2 - 3;
+inline bool is_tree_edge(const Tree &tree, int c) {
+    const Branch &base = tree.branch[c];
+    if (base.n == c) return false;
+    const Branch &parent = tree.branch[base.n];
+    return base.x != parent.x || base.y != parent.y;
+}
+
+void make_segments(RoutingInst &rst, Net &net, Tree &tree) {
     int numSegs = 0;
-    net.nroute.segments = new Segment[maxNumCons];
+    for (int c = 0; c < tree.deg*2 - 2; c++) {
+        if (is_tree_edge(tree, c)) numSegs++;
+    }
+    assert(numSegs <= tree.deg*2 - 3);
 
+    net.nroute.numSegs = numSegs;
+    net.nroute.segments = rst.pool.alloc<Segment>(size_t(numSegs));
+
+    int s = 0;
     for (int c = 0; c < tree.deg*2 - 2; c++) {
+        if (!is_tree_edge(tree, c)) continue;
         Branch &base = tree.branch[c];
-        if (base.n == c) continue;
         Branch &parent = tree.branch[base.n];
-        if (base.x == parent.x && base.y == parent.y) continue;
 
-        net.nroute.segments[numSegs].p1 = Point{base.x, base.y};
-        net.nroute.segments[numSegs].p2 = Point{parent.x, parent.y};
-        numSegs++;
+        net.nroute.segments[s].p1 = Point{base.x, base.y};
+        net.nroute.segments[s].p2 = Point{parent.x, parent.y};
+        s++;
     }
-
-    assert(numSegs <= maxNumCons);
-    net.nroute.numSegs = numSegs;
 }
 
 void flute_calculate_segments(RoutingInst &rst) {
+    waitForFlute();
+
     int xs[MAXD*2];
     int *ys = xs + MAXD;
 
@@ -412,7 +759,7 @@ void flute_calculate_segments(RoutingInst &rst) {
 
         Tree tree = flute(rst.nets[n].numPins, xs, ys, ACCURACY);
 
-        make_segments(rst.nets[n], tree);
+        make_segments(rst, rst.nets[n], tree);
 
         free(tree.branch);
     }
@@ -483,7 +830,7 @@ void routeInitialSolutionCongestion(RoutingInst &rst) {
     flute_calculate_segments(rst);
 
     vector<int> congestion; // ok, sometimes RAII is nice. But defer would be better!
-    congestion.resize(2UL * rst.gx * rst.gy, 0); // fill with 0
+    congestion.resize(size_t(rst.numEdges()), 0); // fill with 0
 
     setup_congestion(congestion, rst);
 
@@ -543,10 +890,20 @@ void ripup(RoutingInst &rst, const SegmentInfo &seg) {
     for (int c = 0; c < seg.seg->numEdges; c++) {
         ripup_edge(rst, *seg.net, seg.seg->edges[c]);
     }
-    delete [] seg.seg->edges;
+    rst.pool.free(seg.seg->edges, size_t(seg.seg->numEdges));
     seg.seg->edges = nullptr;
 }
 
+// Rips up the whole net and gives all of its route's memory back to the pool
+void ripup_net(RoutingInst &rst, Net &net) {
+    for (int s = 0; s < net.nroute.numSegs; s++) {
+        ripup(rst, SegmentInfo(&net, &net.nroute.segments[s]));
+    }
+    rst.pool.free(net.nroute.segments, size_t(net.nroute.numSegs));
+    net.nroute.segments = nullptr;
+    net.nroute.numSegs = 0;
+}
+
 void rerouteCongestionAwareInitialSolution(RoutingInst &rst) {
     // TODO: This redoes a lot of the work that FLUTE does.
     // If we need to make this faster, we can save off the sorted array and pass it into FLUTE.
@@ -562,6 +919,8 @@ void rerouteCongestionAwareInitialSolution(RoutingInst &rst) {
     int adjusted_xs[MAXD];
     int adjusted_ys[MAXD];
 
+    waitForFlute();
+
     for (int n = 0; n < rst.numNets; n++) {
         if (rst.nets[n].numPins <= 2) continue;
 
@@ -627,13 +986,10 @@ void rerouteCongestionAwareInitialSolution(RoutingInst &rst) {
         }
 
         // clear up the segments in the existing solution
-        for (int s = 0; s < rst.nets[n].nroute.numSegs; s++) {
-            ripup(rst, SegmentInfo(&rst.nets[n], &rst.nets[n].nroute.segments[s]));
-        }
-        delete [] rst.nets[n].nroute.segments;
+        ripup_net(rst, rst.nets[n]);
 
         // finally, map the tree onto segments.
-        make_segments(rst.nets[n], t);
+        make_segments(rst, rst.nets[n], t);
 
         // and route it
         for (int s = 0; s < rst.nets[n].nroute.numSegs; s++) {
@@ -665,118 +1021,743 @@ inline int calculate_virtual_overflow(const RoutingInst &rst, const Segment &seg
 
 inline int calculate_total_overflow(const RoutingInst &rst) {
     int of = 0;
-    for (int c = 0; c < rst.numCells; c++) {
-        of += max(0, rst.utilization[c].right - rst.cap);
-        of += max(0, rst.utilization[c].down - rst.cap);
+    for (int e = 0; e < rst.numEdges(); e++) {
+        of += max(0, rst.util(e) - rst.cap);
     }
     return of;
 }
 
-void init_overflow(const RoutingInst &rst, vector<SegmentInfo> &seg_info) {
-    // TODO: iteration like this shits all over the L2 cache
-    // (because seg.seg is a ptr and they may be all out of order)
-    for (auto &seg : seg_info) {
-        seg.overflow = calculate_virtual_overflow(rst, *seg.seg);
+// Collects the segments that cross an edge over its virtual capacity, worst first.
+// Only the nets on those edges are looked at. Returns how many nets that was.
+int find_overflowed_segments(const RoutingInst &rst, vector<SegmentInfo> &seg_info) {
+    vector<char> seen(size_t(rst.numNets), 0);
+    vector<int> nets;
+    for (int e = 0; e < rst.numEdges(); e++) {
+        if (rst.util(e) <= rst.vcap(e)) continue;
+        rst.edge_nets.for_each(e, [&seen, &nets](int n) {
+            if (!seen[n]) {
+                seen[n] = 1;
+                nets.push_back(n);
+            }
+        });
+    }
+    std::sort(nets.begin(), nets.end());
+
+    seg_info.clear();
+    for (int n : nets) {
+        Net &net = rst.nets[n];
+        for (int s = 0; s < net.nroute.numSegs; s++) {
+            SegmentInfo info(&net, &net.nroute.segments[s]);
+            info.overflow = calculate_virtual_overflow(rst, *info.seg);
+            if (info.overflow > 0) seg_info.push_back(info);
+        }
     }
+    std::stable_sort(seg_info.begin(), seg_info.end(),
+              [](const SegmentInfo &a, const SegmentInfo &b) -> bool
+              { return a.overflow > b.overflow; }
+    );
+    return int(nets.size());
 }
 
-void maze_route(RoutingInst &inst, Net *net, Segment *pSegment) {
-    assert(pSegment->edges == nullptr);
+// Search from both pins of a segment at once, which expands far fewer
+// points when the way around congestion is long
+const bool useBidirectionalMazeRoute = true;
 
-    Point tl, br;
-    const int bb_size = 20;
-    tl.x = max(0, min(pSegment->p1.x, pSegment->p2.x) - bb_size);
-    tl.y = max(0, min(pSegment->p1.y, pSegment->p2.y) - bb_size);
-    br.x = min(inst.gx, max(pSegment->p1.x, pSegment->p2.x) + 1 + bb_size);
-    br.y = min(inst.gy, max(pSegment->p1.y, pSegment->p2.y) + 1 + bb_size);
-    vector<Point> path;
-    maze_route_p2p(inst, *net, pSegment->p1, pSegment->p2, tl, br, path);
-
-    pSegment->edges = new int[path.size()-1];
-    pSegment->numEdges = int(path.size() - 1); // path better not be longer than 2^31
+// Lays the segment's edges along a path of neighbouring points, and uses them
+void route_along(RoutingInst &inst, Net &net, Segment &seg, const vector<Point> &path) {
+    seg.edges = inst.pool.alloc<int>(path.size()-1);
+    seg.numEdges = int(path.size() - 1); // path better not be longer than 2^31
     for (int c = 0; c < path.size()-1; c++) {
-        Point &prev = path[c];
-        Point &curr = path[c+1];
+        const Point &prev = path[c];
+        const Point &curr = path[c+1];
         if (prev.x == curr.x) {
             assert(abs(prev.y - curr.y) == 1);
             if (prev.y < curr.y)
-                pSegment->edges[c] = inst.edge_index(prev.x, prev.y, false);
+                seg.edges[c] = inst.edge_index(prev.x, prev.y, false);
             else
-                pSegment->edges[c] = inst.edge_index(curr.x, curr.y, false);
+                seg.edges[c] = inst.edge_index(curr.x, curr.y, false);
         } else {
             assert(prev.y == curr.y);
             assert(abs(prev.x - curr.x) == 1);
 
             if (prev.x < curr.x)
-                pSegment->edges[c] = inst.edge_index(prev.x, prev.y, true);
+                seg.edges[c] = inst.edge_index(prev.x, prev.y, true);
             else
-                pSegment->edges[c] = inst.edge_index(curr.x, curr.y, true);
+                seg.edges[c] = inst.edge_index(curr.x, curr.y, true);
+        }
+        use_edge(inst, net, seg.edges[c]);
+    }
+}
+
+// How far past its pins a maze search may wander
+const int MAZE_MARGIN = 20;
+
+// The cells [tl, br) a maze search between these corners may use
+void maze_box(const RoutingInst &inst, Point lo, Point hi, Point &tl, Point &br) {
+    tl.x = max(0, lo.x - MAZE_MARGIN);
+    tl.y = max(0, lo.y - MAZE_MARGIN);
+    br.x = min(inst.gx, hi.x + 1 + MAZE_MARGIN);
+    br.y = min(inst.gy, hi.y + 1 + MAZE_MARGIN);
+}
+
+void maze_box(const RoutingInst &inst, const Segment &seg, Point &tl, Point &br) {
+    maze_box(inst, Point{min(seg.p1.x, seg.p2.x), min(seg.p1.y, seg.p2.y)},
+                   Point{max(seg.p1.x, seg.p2.x), max(seg.p1.y, seg.p2.y)}, tl, br);
+}
+
+void maze_box(const RoutingInst &inst, const Net &net, Point &tl, Point &br) {
+    Point lo{inst.gx, inst.gy}, hi{0, 0};
+    for (int p = 0; p < net.numPins; p++) {
+        lo.x = min(lo.x, net.pins[p].x);
+        lo.y = min(lo.y, net.pins[p].y);
+        hi.x = max(hi.x, net.pins[p].x);
+        hi.y = max(hi.y, net.pins[p].y);
+    }
+    maze_box(inst, lo, hi, tl, br);
+}
+
+// Finds the path for a segment without changing anything
+void plan_segment(const RoutingInst &inst, const Net &net, const Segment &seg, const Point &tl, const Point &br, vector<Point> &path) {
+    if (useBidirectionalMazeRoute)
+        maze_route_p2p_bidirectional(inst, net, seg.p1, seg.p2, tl, br, path);
+    else
+        maze_route_p2p(inst, net, seg.p1, seg.p2, tl, br, path);
+    assert(path.front() == seg.p1);
+    assert(path.back()  == seg.p2);
+}
+
+void maze_route(RoutingInst &inst, Net *net, Segment *pSegment) {
+    assert(pSegment->edges == nullptr);
+
+    Point tl, br;
+    maze_box(inst, *pSegment, tl, br);
+    vector<Point> path;
+    plan_segment(inst, *net, *pSegment, tl, br, path);
+    route_along(inst, *net, *pSegment, path);
+}
+
+// Finds the paths of a whole net, routed from scratch as a Steiner tree
+// grown one pin at a time (see TreeSearch), without changing anything.
+void plan_net(const RoutingInst &inst, const Net &net, const Point &tl, const Point &br, vector<vector<Point>> &paths) {
+    TreeSearch search(inst, net, tl, br);
+    paths.clear();
+    while (!search.done()) {
+        paths.emplace_back();
+        search.connect(paths.back());
+    }
+}
+
+// Gives a ripped up net the route plan_net found, one segment per path
+void route_net_along(RoutingInst &inst, Net &net, const vector<vector<Point>> &paths) {
+    assert(net.nroute.segments == nullptr);
+    net.nroute.numSegs = int(paths.size());
+    net.nroute.segments = inst.pool.alloc<Segment>(paths.size());
+    for (size_t s = 0; s < paths.size(); s++) {
+        Segment &seg = net.nroute.segments[s];
+        seg.p1 = paths[s].front();
+        seg.p2 = paths[s].back();
+        route_along(inst, net, seg, paths[s]);
+    }
+}
+
+// Routes a whole net from scratch (see plan_net). Every search becomes a segment.
+void maze_route_net(RoutingInst &inst, Net &net) {
+    Point tl, br;
+    maze_box(inst, net, tl, br);
+    vector<vector<Point>> paths;
+    plan_net(inst, net, tl, br, paths);
+    route_net_along(inst, net, paths);
+}
+
+void RouteJournal::ripup(RoutingInst &rst, Net &net, Segment &seg) {
+    for (int c = 0; c < seg.numEdges; c++) {
+        ripup_edge(rst, net, seg.edges[c]);
+    }
+    entries.push_back(Entry{&net, &seg, seg.numEdges, seg.edges, Route()});
+    seg.edges = nullptr;
+}
+
+void RouteJournal::ripup(RoutingInst &rst, Net &net) {
+    for (int s = 0; s < net.nroute.numSegs; s++) {
+        const Segment &seg = net.nroute.segments[s];
+        for (int c = 0; c < seg.numEdges; c++) {
+            ripup_edge(rst, net, seg.edges[c]);
+        }
+    }
+    entries.push_back(Entry{&net, nullptr, 0, nullptr, net.nroute});
+    net.nroute = Route();
+}
+
+void RouteJournal::commit(RoutingInst &rst) {
+    for (const Entry &entry : entries) {
+        rst.pool.free(entry.edges, size_t(entry.numEdges));
+        for (int s = 0; s < entry.route.numSegs; s++) {
+            rst.pool.free(entry.route.segments[s].edges, size_t(entry.route.segments[s].numEdges));
+        }
+        rst.pool.free(entry.route.segments, size_t(entry.route.numSegs));
+    }
+    entries.clear();
+}
+
+void RouteJournal::rollback(RoutingInst &rst) {
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+        if (it->seg == nullptr) {
+            Net &net = *it->net;
+            if (net.nroute.segments != nullptr) {
+                ::ripup_net(rst, net);
+            }
+            net.nroute = it->route;
+            for (int s = 0; s < net.nroute.numSegs; s++) {
+                const Segment &seg = net.nroute.segments[s];
+                for (int c = 0; c < seg.numEdges; c++) {
+                    use_edge(rst, net, seg.edges[c]);
+                }
+            }
+            continue;
+        }
+
+        Segment &seg = *it->seg;
+        if (seg.edges != nullptr) {
+            ::ripup(rst, SegmentInfo(it->net, &seg));
+        }
+        seg.numEdges = it->numEdges;
+        seg.edges = it->edges;
+        for (int c = 0; c < seg.numEdges; c++) {
+            use_edge(rst, *it->net, seg.edges[c]);
+        }
+    }
+    entries.clear();
+}
+
+size_t RouteJournal::bytes() const {
+    size_t bytes = entries.capacity() * sizeof(Entry);
+    for (const Entry &entry : entries) {
+        bytes += size_t(entry.numEdges) * sizeof(int);
+        bytes += size_t(entry.route.numSegs) * sizeof(Segment);
+        for (int s = 0; s < entry.route.numSegs; s++) {
+            bytes += size_t(entry.route.segments[s].numEdges) * sizeof(int);
+        }
+    }
+    return bytes;
+}
+
+// Count data TLB misses while maze routing, to see what huge pages buy (see huge_pages.h)
+const bool measureTlbMisses = true;
+static PerfCounter mazeTlbMisses;
+static std::atomic<long long> workerTlbMisses{0};
+static std::chrono::steady_clock::duration mazeRoutingTime{0};
+
+// A perf counter only sees the thread that opened it, so every reroute
+// worker but the calling thread (counted by mazeTlbMisses) opens its own
+// and adds it to workerTlbMisses when done.
+struct WorkerTlbMisses {
+    PerfCounter counter;
+
+    explicit WorkerTlbMisses(int thread) {
+        if (thread > 0 && mazeTlbMisses.is_open() && counter.open_dtlb_load_misses()) counter.start();
+    }
+    ~WorkerTlbMisses() {
+        if (!counter.is_open()) return;
+        counter.stop();
+        workerTlbMisses += counter.count();
+    }
+};
+
+// Maze route on every core (see rerouteParallel). Off until the speedup
+// has been measured on a multi-core machine.
+const bool useParallelReroute = false;
+// How many threads that takes, 0 for one per core
+const int rerouteThreads = 0;
+// Route in batches so results match routing one at a time, and don't
+// depend on the thread count or timing. Otherwise threads never wait on a
+// batch, so they're kept busier, but the order conflicting searches go in
+// (and so the result) depends on which thread gets there first.
+const bool deterministicReroute = true;
+
+// A segment, or a whole net, to maze route alongside others
+struct RerouteTask {
+    Net *net;
+    Segment *seg;  /* null to reroute the whole net, which isn't ripped up yet */
+    Point tl, br;  /* the cells its searches may use (see maze_box) */
+    vector<vector<Point>> paths;
+    bool done = false;
+
+    RerouteTask(Net *net, Segment *seg) : net(net), seg(seg) {}
+};
+
+// Tasks are indexed by the coarse tiles their boxes cover, to find the
+// earlier tasks a box might overlap without comparing against all of them
+const int REROUTE_TILE = 16;
+
+inline bool boxes_overlap(const RerouteTask &a, const RerouteTask &b) {
+    return a.tl.x < b.br.x && b.tl.x < a.br.x && a.tl.y < b.br.y && b.tl.y < a.br.y;
+}
+
+template<typename F>
+inline void for_each_tile(const RerouteTask &task, int tiles_x, F fn) {
+    for (int ty = task.tl.y / REROUTE_TILE; ty <= (task.br.y - 1) / REROUTE_TILE; ty++) {
+        for (int tx = task.tl.x / REROUTE_TILE; tx <= (task.br.x - 1) / REROUTE_TILE; tx++) {
+            fn(ty * tiles_x + tx);
         }
-        use_edge(inst, *net, pSegment->edges[c]);
     }
-    assert(path.front() == pSegment->p1);
-    assert(path.back()  == pSegment->p2);
 }
 
-void ripupAndReroute(RoutingInst &rst, vector<SegmentInfo> &seg_info, time_t time_limit) {
+// Runs the task's searches. Reads the routing instance but changes nothing,
+// so tasks whose boxes don't overlap can plan at the same time.
+void plan_task(const RoutingInst &rst, RerouteTask &task) {
+    if (task.seg == nullptr) {
+        plan_net(rst, *task.net, task.tl, task.br, task.paths);
+    } else {
+        task.paths.resize(1);
+        task.paths[0].clear();
+        plan_segment(rst, *task.net, *task.seg, task.tl, task.br, task.paths[0]);
+    }
+}
+
+// Routes along the planned paths. One thread at a time.
+void commit_task(RoutingInst &rst, RerouteTask &task) {
+    if (task.seg == nullptr)
+        route_net_along(rst, *task.net, task.paths);
+    else
+        route_along(rst, *task.net, *task.seg, task.paths[0]);
+    vector<vector<Point>>().swap(task.paths);
+    task.done = true;
+}
+
+/**
+ * Maze routes the tasks, in order of priority, on several threads. A task
+ * only reads and writes edges inside its box, so tasks whose boxes don't
+ * overlap (and, for segments, that aren't of the same net) can search at
+ * once; writing the routes back (pool, edge state, edge nets) is serial.
+ * Deterministic: each task goes in the batch after the last earlier task
+ * whose box overlaps its own or that has the same net. Each batch plans in
+ * parallel, then commits in order, which gives exactly what routing one at
+ * a time would.
+ * Otherwise: a thread takes the first waiting task (within a short window)
+ * whose box overlaps no running task's and whose net nobody is working on,
+ * and commits it as soon as it's planned.
+ * Whole-net tasks are ripped up right before they're planned. Stops
+ * starting tasks with a minute left; the ones that didn't get done have
+ * done == false.
+ */
+void rerouteParallel(RoutingInst &rst, time_t time_limit, vector<RerouteTask> &tasks, RouteJournal &journal, int threads) {
+    for (RerouteTask &task : tasks) {
+        if (task.seg == nullptr)
+            maze_box(rst, *task.net, task.tl, task.br);
+        else
+            maze_box(rst, *task.seg, task.tl, task.br);
+    }
+
+    time_t start_time = time(nullptr);
+    time_t lastElapsed = -1;
+    size_t routed_count = 0;
+    bool out_of_time = false;
+    // after each commit: progress, and whether to stop
+    auto committed = [&](size_t count) {
+        routed_count += count;
+        time_t now = time(nullptr);
+        time_t elapsed = now - start_time;
+        if (elapsed - lastElapsed >= 1) {
+            cout << "\rRouted " << routed_count << " of " << tasks.size() << " on " << threads << " threads ("
+                 << elapsed << " elapsed)." << std::flush;
+            lastElapsed = elapsed;
+            if (time_limit - now < 60) {
+                cout << " Out of time!";
+                out_of_time = true;
+            }
+        }
+    };
+    auto start = [&](RerouteTask &task) {
+        if (task.seg == nullptr) journal.ripup(rst, *task.net);
+    };
+
+    if (deterministicReroute) {
+        int tiles_x = (rst.gx + REROUTE_TILE - 1) / REROUTE_TILE;
+        int tiles_y = (rst.gy + REROUTE_TILE - 1) / REROUTE_TILE;
+        vector<vector<int>> tile_tasks(size_t(tiles_x) * tiles_y); // earlier tasks touching each tile
+        vector<int> tile_batch(tile_tasks.size(), -1);             // the latest batch among them
+        vector<int> net_batch(size_t(rst.numNets), -1);
+        vector<int> task_batch(tasks.size());
+        vector<vector<int>> batches;
+        for (int t = 0; t < int(tasks.size()); t++) {
+            const RerouteTask &task = tasks[t];
+            int batch = net_batch[task.net - rst.nets] + 1;
+            for_each_tile(task, tiles_x, [&](int tile) {
+                if (tile_batch[tile] < batch) return;
+                for (int other : tile_tasks[tile]) {
+                    if (task_batch[other] >= batch && boxes_overlap(task, tasks[other])) batch = task_batch[other] + 1;
+                }
+            });
+            task_batch[t] = batch;
+            net_batch[task.net - rst.nets] = batch;
+            for_each_tile(task, tiles_x, [&](int tile) {
+                tile_tasks[tile].push_back(t);
+                tile_batch[tile] = max(tile_batch[tile], batch);
+            });
+            if (batch == int(batches.size())) batches.emplace_back();
+            batches[batch].push_back(t);
+        }
+        cout << tasks.size() << " searches in " << batches.size() << " batches" << endl;
+
+        Barrier barrier(threads);
+        std::atomic<int> next{0};
+        run_threads(threads, [&](int thread) {
+            WorkerTlbMisses tlb_misses(thread);
+            for (const vector<int> &batch : batches) {
+                if (thread == 0) {
+                    for (int t : batch) start(tasks[t]);
+                    next = 0;
+                }
+                barrier.wait();
+
+                for (int i = next++; i < int(batch.size()); i = next++) {
+                    plan_task(rst, tasks[batch[i]]);
+                }
+                barrier.wait();
+
+                if (thread == 0) {
+                    for (int t : batch) commit_task(rst, tasks[t]);
+                    committed(batch.size());
+                }
+                barrier.wait();
+                if (out_of_time) break;
+            }
+        });
+        return;
+    }
+
+    // Tasks that aren't done or started, in order. Only the first few are
+    // looked at, so a big task at the front can't be skipped forever.
+    const int WINDOW = 64;
+    std::list<int> waiting;
+    for (int t = 0; t < int(tasks.size()); t++) waiting.push_back(t);
+    vector<int> running; // tasks being planned
+    vector<char> net_busy(size_t(rst.numNets), 0);
+    std::mutex mutex;
+    std::condition_variable finished; // a task, freeing its box
+
+    run_threads(threads, [&](int thread) {
+        WorkerTlbMisses tlb_misses(thread);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!waiting.empty() && !out_of_time) {
+            auto it = waiting.begin();
+            bool found = false;
+            for (int w = 0; !found && it != waiting.end() && w < WINDOW; w++) {
+                const RerouteTask &task = tasks[*it];
+                found = !net_busy[task.net - rst.nets] &&
+                        std::none_of(running.begin(), running.end(), [&](int r) { return boxes_overlap(task, tasks[r]); });
+                if (!found) ++it;
+            }
+            if (!found) {
+                finished.wait(lock);
+                continue;
+            }
+
+            int t = *it;
+            RerouteTask &task = tasks[t];
+            waiting.erase(it);
+            net_busy[task.net - rst.nets] = 1;
+            running.push_back(t);
+            start(task);
+
+            lock.unlock();
+            plan_task(rst, task);
+            lock.lock();
+
+            commit_task(rst, task);
+            net_busy[task.net - rst.nets] = 0;
+            running.erase(std::find(running.begin(), running.end(), t));
+            committed(1);
+            finished.notify_all();
+        }
+    });
+}
+
+// Threads to reroute on, 1 when not in parallel. A running output prefetch
+// worker has a core to itself.
+int reroute_threads(const OutputPrefetch *prefetch) {
+    if (!useParallelReroute) return 1;
+    if (rerouteThreads > 0) return rerouteThreads;
+    return max(1, hardware_threads() - (prefetch != nullptr ? 1 : 0));
+}
+
+// Rip up and reroute whole nets instead of single segments (see maze_route_net).
+// Off until it beats segment reroute on expansions and wirelength.
+const bool useNetLevelReroute = false;
+
+// Reroutes every net with an overflowed segment as a whole, worst total
+// overflow first. Each net is ripped up right before it's rerouted, so
+// running out of time just leaves the rest of them alone.
+void rerouteNets(RoutingInst &rst, time_t time_limit, const vector<SegmentInfo> &seg_info, RouteJournal &journal, int threads) {
+    vector<int> net_overflow(size_t(rst.numNets), 0);
+    vector<Net *> nets;
+    for (const SegmentInfo &info : seg_info) {
+        int n = int(info.net - rst.nets);
+        if (net_overflow[n] == 0) nets.push_back(info.net);
+        net_overflow[n] += info.overflow;
+    }
+    std::stable_sort(nets.begin(), nets.end(), [&rst, &net_overflow](const Net *a, const Net *b) -> bool {
+        return net_overflow[a - rst.nets] > net_overflow[b - rst.nets];
+    });
+
+    cout << "Reroute " << nets.size() << " nets" << endl;
+    mazeTlbMisses.start();
+    auto maze_start = std::chrono::steady_clock::now();
+    time_t start_time = time(nullptr);
+    time_t lastElapsed = -1;
+    int routed_count = 0;
+    if (threads > 1) {
+        vector<RerouteTask> tasks;
+        for (Net *net : nets) tasks.emplace_back(net, nullptr);
+        rerouteParallel(rst, time_limit, tasks, journal, threads);
+        routed_count = int(std::count_if(tasks.begin(), tasks.end(), [](const RerouteTask &t) { return t.done; }));
+    } else {
+        for (Net *net : nets) {
+            journal.ripup(rst, *net);
+            maze_route_net(rst, *net);
+            routed_count++;
+
+            // check time remaining
+            time_t now = time(nullptr);
+            time_t elapsed = now - start_time;
+            if (elapsed - lastElapsed >= 1) {
+                time_t estimated = elapsed * time_t(nets.size()) / routed_count;
+                cout << "\rRouted " << routed_count << " of " << nets.size() << " (" << elapsed << " elapsed, " <<
+                estimated << " total)." << std::flush;
+                lastElapsed = elapsed;
+
+                // with a minute left, keep the routes we haven't gotten to
+                if (time_limit - now < 60) {
+                    cout << " Out of time!";
+                    break;
+                }
+            }
+        }
+    }
+    mazeTlbMisses.stop();
+    mazeRoutingTime += std::chrono::steady_clock::now() - maze_start;
+    time_t elapsed = time(nullptr) - start_time;
+    cout << "\r" << routed_count << " nets routed in " << elapsed << " seconds." << endl;
+}
+
+void ripupAndReroute(RoutingInst &rst, time_t time_limit, OutputPrefetch *prefetch, RouteJournal &journal) {
     cout << "Calculate overflow" << endl;
-    init_overflow(rst, seg_info);
-    std::sort(seg_info.begin(), seg_info.end(),
-              [](const SegmentInfo &a, const SegmentInfo &b) -> bool
-              { return a.overflow > b.overflow; }
-    );
+    vector<SegmentInfo> seg_info;
+    int net_count = find_overflowed_segments(rst, seg_info);
+
+    if (prefetch != nullptr) {
+        // everything we aren't about to rip up is final for this iteration
+        vector<char> touched(size_t(rst.numNets), 0);
+        for (auto &info : seg_info) {
+            touched[info.net - rst.nets] = 1;
+        }
+        prefetch->restart(rst, touched);
+    }
+    int threads = reroute_threads(prefetch);
+
+    if (useNetLevelReroute) {
+        cout << seg_info.size() << " segments of " << net_count << " nets on overflowed edges ("
+             << float(net_count*100)/rst.numNets << "% of nets)" << endl;
+        rerouteNets(rst, time_limit, seg_info, journal, threads);
+        return;
+    }
 
     cout << "Ripup" << endl;
     int over_count = 0;
     for (auto &info : seg_info) {
-        if (info.overflow > 0) {
-            ripup(rst, info);
-            over_count++;
-        }
-        else break;
+        journal.ripup(rst, *info.net, *info.seg);
+        over_count++;
     }
-    cout << over_count << " of " << seg_info.size() << " nets were overflowed (" << float(over_count*100)/seg_info.size() << "%)" << endl;
+    cout << over_count << " segments of " << net_count << " nets on overflowed edges ("
+         << float(net_count*100)/rst.numNets << "% of nets)" << endl;
 
     cout << "Reroute" << endl;
+    mazeTlbMisses.start();
+    auto maze_start = std::chrono::steady_clock::now();
     time_t start_time = time(nullptr);
     time_t lastElapsed = -1;
     int routed_count = 0;
-    bool panicked = false;
-    for (auto &info : seg_info) {
-        if (info.overflow > 0) {
-            if (!panicked) { // hurray for branch prediction!
-                routed_count++;
-
-                maze_route(rst, info.net, info.seg);
-
-                // check time remaining
-                time_t now = time(nullptr);
-                time_t elapsed = now - start_time;
-                if (elapsed - lastElapsed >= 1) {
-                    time_t estimated = elapsed * over_count / routed_count;
-                    cout << "\rRouted " << routed_count << " of " << over_count << " (" << elapsed << " elapsed, " <<
-                    estimated << " total)." << std::flush;
-                    lastElapsed = elapsed;
-
-                    // panic if we have one minute left, and just L-route everything.
-                    if (time_limit - now < 60) {
-                        cout << "ohcrapohcrapohcrapohcrap runningrunningRUNNING!!!!";
-                        panicked = true;
+    if (threads > 1) {
+        vector<RerouteTask> tasks;
+        for (auto &info : seg_info) tasks.emplace_back(info.net, info.seg);
+        rerouteParallel(rst, time_limit, tasks, journal, threads);
+        for (RerouteTask &task : tasks) {
+            if (!task.done) L_route(rst, *task.net, *task.seg); // out of time
+        }
+    } else {
+        bool panicked = false;
+        for (auto &info : seg_info) {
+            if (info.overflow > 0) {
+                if (!panicked) { // hurray for branch prediction!
+                    routed_count++;
+
+                    maze_route(rst, info.net, info.seg);
+
+                    // check time remaining
+                    time_t now = time(nullptr);
+                    time_t elapsed = now - start_time;
+                    if (elapsed - lastElapsed >= 1) {
+                        time_t estimated = elapsed * over_count / routed_count;
+                        cout << "\rRouted " << routed_count << " of " << over_count << " (" << elapsed << " elapsed, " <<
+                        estimated << " total)." << std::flush;
+                        lastElapsed = elapsed;
+
+                        // panic if we have one minute left, and just L-route everything.
+                        if (time_limit - now < 60) {
+                            cout << "ohcrapohcrapohcrapohcrap runningrunningRUNNING!!!!";
+                            panicked = true;
+                        }
                     }
+                } else {
+                    // we are OUT OF TIME! L-route EVERYTHING!!!
+                    // TODO: A shittier, faster L-route that doesn't pick the optimal L.
+                    L_route(rst, *info.net, *info.seg);
                 }
-            } else {
-                // we are OUT OF TIME! L-route EVERYTHING!!!
-                // TODO: A shittier, faster L-route that doesn't pick the optimal L.
-                L_route(rst, *info.net, *info.seg);
             }
+            else break;
         }
-        else break;
     }
+    mazeTlbMisses.stop();
+    mazeRoutingTime += std::chrono::steady_clock::now() - maze_start;
     time_t elapsed = time(nullptr) - start_time;
     cout << "\r" << over_count << " nets routed in " << elapsed << " seconds." << endl;
 }
 
-void solveRouting(RoutingInst &rst, time_t time_limit, bool shitty_initial) {
+void report_huge_pages() {
+    const HugePageStats &stats = HugePageStats::get();
+    cout << "Grid arrays: " << (stats.hugetlb >> 20) << " MB on huge pages, "
+         << (stats.advised >> 20) << " MB advised for transparent huge pages";
+    long kb = anon_huge_pages_kb();
+    if (kb >= 0) cout << " (" << (kb >> 10) << " MB got them)";
+    cout << "." << endl;
+
+    if (!measureTlbMisses) return;
+    if (mazeTlbMisses.is_open())
+        cout << "Maze routing dTLB load misses: " << mazeTlbMisses.count() + workerTlbMisses << endl;
+    else
+        cout << "Maze routing dTLB load misses: unavailable (" << mazeTlbMisses.error() << ")" << endl;
+}
+
+// Frontier throughput over all the maze routing of this run (see `make bench-frontier`)
+void report_frontier() {
+    const AStarStats &stats = AStarStats::get();
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(mazeRoutingTime).count();
+    long long pushes = stats.pushes.load(), pops = stats.pops.load();
+    cout << "Maze routing: " << stats.searches.load() << " searches, " << pushes << " pushes, "
+         << pops << " pops in " << ms << " ms";
+    if (ms > 0) cout << " (" << (pushes + pops) / ms << " ops/ms)";
+    cout << " with the " << Frontier::name() << " frontier." << endl;
+}
+
+// Time the edge cost function over real L-route and maze searches once
+// routing is done, to compare edge state layouts (see `make bench-layouts`).
+// Built in with -DCOST_BENCH=1.
+#ifndef COST_BENCH
+#define COST_BENCH 0
+#endif
+const bool benchmarkCostEvaluation = COST_BENCH;
+const int COST_BENCH_SEARCHES = 2000;
+
+void report_cost_evaluation(const RoutingInst &rst) {
+    using std::chrono::steady_clock;
+    using std::chrono::microseconds;
+    auto cost = [&rst](int e) -> int { return default_cost(rst, e); };
+
+    // both Ls of every routed segment
+    long long l_routes = 0, l_costs = 0, l_total = 0;
+    auto start = steady_clock::now();
+    for (int n = 0; n < rst.numNets; n++) {
+        const Route &route = rst.nets[n].nroute;
+        for (int s = 0; s < route.numSegs; s++) {
+            const Segment &seg = route.segments[s];
+            int bxpy, bypx;
+            L_costs(rst, seg, cost, bxpy, bypx);
+            l_total += min(bxpy, bypx);
+            l_costs += 2 * (abs(seg.p1.x - seg.p2.x) + abs(seg.p1.y - seg.p2.y));
+            l_routes++;
+        }
+    }
+    long long l_us = std::chrono::duration_cast<microseconds>(steady_clock::now() - start).count();
+
+    // maze searches between the ends of the first segments, in net order
+    const AStarStats &stats = AStarStats::get();
+    long long pushes_before = stats.pushes.load();
+    int searches = 0;
+    vector<Point> path;
+    start = steady_clock::now();
+    for (int n = 0; n < rst.numNets && searches < COST_BENCH_SEARCHES; n++) {
+        const Net &net = rst.nets[n];
+        for (int s = 0; s < net.nroute.numSegs && searches < COST_BENCH_SEARCHES; s++) {
+            const Segment &seg = net.nroute.segments[s];
+            if (seg.p1 == seg.p2) continue;
+            Point tl, br;
+            maze_box(rst, seg, tl, br);
+            path.clear();
+            maze_route_p2p(rst, net, seg.p1, seg.p2, tl, br, path);
+            searches++;
+        }
+    }
+    long long maze_us = std::chrono::duration_cast<microseconds>(steady_clock::now() - start).count();
+
+    cout << "Cost evaluation: " << l_routes << " L-routes, " << l_costs << " edge costs in " << l_us / 1000 << " ms";
+    if (l_us > 0) cout << " (" << l_costs / l_us << " per us)";
+    cout << "; " << searches << " maze searches, " << stats.pushes.load() - pushes_before << " pushes in "
+         << maze_us / 1000 << " ms (" << EdgeState::layout_name() << " edge layout, L total " << l_total << ")." << endl;
+}
+
+// Print where the memory goes after each phase (parse, initial route, every RUARR iteration, output)
+const bool reportMemoryUsage = true;
+
+inline double megabytes(size_t bytes) {
+    return double(bytes) / (1 << 20);
+}
+
+void reportMemory(const char *phase, const RoutingInst &rst, const RouteJournal *journal, const OutputPrefetch *prefetch) {
+    if (!reportMemoryUsage) return;
+
+    size_t pins = 0, segments = 0, route_edges = 0, routed_edges = 0;
+    for (int n = 0; n < rst.numNets; n++) {
+        const Net &net = rst.nets[n];
+        pins += size_t(net.numPins) * sizeof(Point);
+        if (net.nroute.numSegs > 0) {
+            segments += size_t(net.nroute.numSegs) * sizeof(Segment);
+            for (int s = 0; s < net.nroute.numSegs; s++) {
+                route_edges += size_t(net.nroute.segments[s].numEdges) * sizeof(int);
+            }
+        }
+        routed_edges += net.routed_edges.bytes();
+    }
+
+    ProcessMemory process = ProcessMemory::get();
+    std::ios::fmtflags flags = cout.flags();
+    std::streamsize precision = cout.precision();
+    cout << std::fixed;
+    cout.precision(1);
+
+    cout << "Memory after " << phase << ": ";
+    if (process.rss_kb >= 0) cout << (process.rss_kb >> 10) << " MB RSS, ";
+    cout << (process.peak_rss_kb >> 10) << " MB peak RSS" << endl;
+    // pins read from the benchmark cache are mapped from it, not in the pool
+    cout << "  nets " << megabytes(size_t(rst.numNets) * sizeof(Net))
+         << " MB, pins " << megabytes(pins)
+         << " MB, segments " << megabytes(segments)
+         << " MB, route edges " << megabytes(route_edges)
+         << " MB (pool " << megabytes(rst.pool.reserved_bytes()) << " MB)" << endl;
+    cout << "  routed_edges " << megabytes(routed_edges)
+         << " MB, edge state " << megabytes(rst.edges.bytes())
+         << " MB, edge nets " << megabytes(rst.edge_nets.bytes())
+         << " MB, A* domain " << megabytes(AStarStats::get().peak_bytes.load()) << " MB peak";
+    if (journal != nullptr) cout << ", journal " << megabytes(journal->bytes()) << " MB";
+    if (prefetch != nullptr) cout << ", output prefetch " << megabytes(prefetch->bytes()) << " MB";
+    cout << endl;
+
+    cout.flags(flags);
+    cout.precision(precision);
+    AStarStats::get().peak_bytes = 0; // the next report gets the next phase's peak
+}
+
+void solveRouting(RoutingInst &rst, time_t time_limit, bool shitty_initial, OutputPrefetch *prefetch) {
+    if (measureTlbMisses) mazeTlbMisses.open_dtlb_load_misses();
 
     // find initial solution
     if (shitty_initial)
@@ -788,17 +1769,10 @@ void solveRouting(RoutingInst &rst, time_t time_limit, bool shitty_initial) {
 
     if (useCongestionAwareTreeGen)
         rerouteCongestionAwareInitialSolution(rst);
-
-    // build array of all segments
-    vector<SegmentInfo> seg_info;
-    for (int n = 0; n < rst.numNets; n++) {
-        for (int s = 0; s < rst.nets[n].nroute.numSegs; s++) {
-            seg_info.emplace_back(&rst.nets[n], &rst.nets[n].nroute.segments[s]);
-        }
-    }
+    reportMemory("initial route", rst);
 
     // iterate RUaRR until time limit is exceeded
-    RoutingSolution currentBest;
+    RouteJournal journal; // to undo an iteration that didn't help
     int currentBestOverflow;
 
     time_t startTime = time(nullptr);
@@ -827,23 +1801,21 @@ void solveRouting(RoutingInst &rst, time_t time_limit, bool shitty_initial) {
 
         if (ruarr_iter > 1) {
 	  // update virtual capacity
-	  for(int c = 0; c < rst.gx*rst.gy; c++) {
+	  for(int e = 0; e < rst.numEdges(); e++) {
 	    int capacity = rst.cap;
-	    int utilRight = rst.utilization[c].right;
-	    int utilDown = rst.utilization[c].down;
-	    int overflowRight = utilRight - capacity;
-	    int overflowDown = utilDown - capacity;
-	    rst.virtual_cap[c].right = min(rst.virtual_cap[c].right - overflowRight, capacity);
-	    rst.virtual_cap[c].down = min(rst.virtual_cap[c].down - overflowDown, capacity);
+	    int edgeOverflow = rst.util(e) - capacity;
+	    rst.edges.set_vcap(e, min(rst.vcap(e) - edgeOverflow, capacity));
 	  }
         }
 
         cout << "Overflow: " << overflow << endl;
         currentBestOverflow = overflow;
-        currentBest.clone(rst);
 
         cout << "\nBeginning RipupAndReroute iteration " << ruarr_iter << endl;
-        ripupAndReroute(rst, seg_info, time_limit);
+        ripupAndReroute(rst, time_limit, prefetch, journal);
+        stringstream phase;
+        phase << "RUARR iteration " << ruarr_iter;
+        reportMemory(phase.str().c_str(), rst, &journal, prefetch);
 
         overflow = calculate_total_overflow(rst);
         currentTime = time(nullptr);
@@ -854,13 +1826,21 @@ void solveRouting(RoutingInst &rst, time_t time_limit, bool shitty_initial) {
         expectedQ = (currentOverflow + overflowChange)*(1 + ((currentTime - startTime + timeChange)/secsIn15Min));
         if (overflow >= currentBestOverflow) {
             cout << "Overflow no longer decreasing!" << endl;
-            std::move(currentBest).restore(rst);
+            if (prefetch != nullptr) prefetch->stop();
+            journal.rollback(rst);
             break;
         }else if((expectedQ >= currentQ) && ((currentTime - startTime) >= secsIn5Min)){
             cout << "Overflow not decreasing fast enough!" << endl;
             break;
         }
+        journal.commit(rst);
     }
+    journal.commit(rst);
+
+    if (prefetch != nullptr) prefetch->stop();
+    report_huge_pages();
+    report_frontier();
+    if (benchmarkCostEvaluation) report_cost_evaluation(rst);
 }
 
 
@@ -870,13 +1850,183 @@ inline bool is_straight(int p1ex, int p2ex) {
     return (p1ex & 1) == (p2ex & 1);
 }
 
-inline void write_line(ostream &out, RoutingInst &inst, int edge1, int edge2) {
+// zlib level for compressed output. Route text is repetitive enough that
+// the fast levels already get most of the ratio.
+const int OUTPUT_GZIP_LEVEL = 3;
+
+// Appends the data to out as one complete gzip member. Members can simply
+// be concatenated and the result is still a valid .gz file, so blocks can
+// be compressed independently on different threads.
+void gzip_block(const char *data, size_t size, string &out) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, OUTPUT_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        cerr << "ERROR: couldn't start zlib" << endl;
+        exit(1);
+    }
+
+    size_t start = out.size();
+    size_t bound = deflateBound(&zs, uLong(size));
+    out.resize(start + bound);
+
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    zs.avail_in = uInt(size);
+    zs.next_out = reinterpret_cast<Bytef *>(&out[start]);
+    zs.avail_out = uInt(bound);
+    int result = deflate(&zs, Z_FINISH);
+    assert(result == Z_STREAM_END);
+    (void) result;
+
+    out.resize(start + zs.total_out);
+    deflateEnd(&zs);
+}
+
+// Formats route text into one big reusable buffer and hands it to the
+// stream in large blocks, instead of an operator<< (and a flush) per line.
+// Without a stream the buffer just grows, and the owner decides when to write it.
+class OutputBuffer {
+public:
+    static const size_t CAPACITY = 1 << 20;
+    static const size_t MAX_LINE = 64; // longest thing written between reserve() calls
+
+    explicit OutputBuffer(ostream *out = nullptr)
+            : out(out), data(new char[CAPACITY]), capacity(CAPACITY), used(0) {}
+    OutputBuffer(const OutputBuffer &) = delete;
+    OutputBuffer &operator=(const OutputBuffer &) = delete;
+    ~OutputBuffer() {
+        flush();
+        delete [] data;
+    }
+
+    // Makes room for MAX_LINE more characters. The put* calls don't check.
+    inline void reserve() {
+        if (used + MAX_LINE > capacity) make_room();
+    }
+
+    inline void flush() {
+        if (out != nullptr) write_to(*out);
+    }
+
+    // writes out everything buffered so far and empties the buffer (keeping its memory)
+    inline void write_to(ostream &stream) {
+        stream.write(data, used);
+        used = 0;
+    }
+
+    inline void write_to(string &str) {
+        str.assign(data, used);
+        used = 0;
+    }
+
+    // compresses everything buffered so far into str, and empties the buffer
+    inline void gzip_to(string &str) {
+        str.clear();
+        gzip_block(data, used, str);
+        used = 0;
+    }
+
+    // for text that's already formatted, of any length
+    inline void put_text(const string &text) {
+        if (used + text.size() > capacity) {
+            if (out != nullptr && text.size() > capacity) {
+                // too big to ever fit, skip the buffer
+                flush();
+                out->write(text.data(), text.size());
+                return;
+            }
+            while (used + text.size() > capacity) make_room();
+        }
+        memcpy(data + used, text.data(), text.size());
+        used += text.size();
+    }
+
+    inline void put(char c) {
+        data[used++] = c;
+    }
+
+    inline void put_int(int value) {
+        unsigned v = unsigned(value);
+        if (value < 0) {
+            put('-');
+            v = 0u - v;
+        }
+
+        // fill from the back, two digits at a time
+        char tmp[12];
+        char *p = tmp + sizeof(tmp);
+        while (v >= 100) {
+            unsigned r = (v % 100) * 2;
+            v /= 100;
+            *--p = DIGIT_PAIRS[r + 1];
+            *--p = DIGIT_PAIRS[r];
+        }
+        if (v >= 10) {
+            *--p = DIGIT_PAIRS[v * 2 + 1];
+            *--p = DIGIT_PAIRS[v * 2];
+        } else {
+            *--p = char('0' + v);
+        }
+
+        size_t len = size_t(tmp + sizeof(tmp) - p);
+        memcpy(data + used, p, len);
+        used += len;
+    }
+
+    inline void put_point(const Point &p) {
+        put('(');
+        put_int(p.x);
+        put(',');
+        put_int(p.y);
+        put(')');
+    }
+
+private:
+    static const char DIGIT_PAIRS[201];
+
+    void make_room() {
+        if (out != nullptr) {
+            flush();
+            return;
+        }
+
+        capacity *= 2;
+        char *bigger = new char[capacity];
+        memcpy(bigger, data, used);
+        delete [] data;
+        data = bigger;
+    }
+
+    ostream *out;
+    char *data;
+    size_t capacity;
+    size_t used;
+};
+
+const char OutputBuffer::DIGIT_PAIRS[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+inline void write_line(OutputBuffer &out, const RoutingInst &inst, int edge1, int edge2) {
     if (edge1 > edge2)
         std::swap(edge1, edge2);
-    out << inst.point_from_edge(edge1) << '-' << inst.point(inst.end(edge2)) << endl;
+    out.reserve();
+    out.put_point(inst.point_from_edge(edge1));
+    out.put('-');
+    out.put_point(inst.point(inst.end(edge2)));
+    out.put('\n');
 }
 
-inline void write_segment(ostream &out, RoutingInst &rst, Segment &segment) {
+inline void write_segment(OutputBuffer &out, const RoutingInst &rst, const Segment &segment) {
+    if (segment.numEdges == 0) return; // duplicate pins, nothing to draw
+
     int edge = segment.edges[0];
     for (int c = 1; c < segment.numEdges; c++) {
         if (!is_straight(edge, segment.edges[c])) {
@@ -887,18 +2037,309 @@ inline void write_segment(ostream &out, RoutingInst &rst, Segment &segment) {
     write_line(out, rst, edge, segment.edges[segment.numEdges-1]);
 }
 
-void writeOutput(ostream &out, RoutingInst &rst){
+inline void write_net(OutputBuffer &out, const RoutingInst &rst, int n) {
+    out.reserve();
+    out.put('n');
+    out.put_int(n);
+    out.put('\n');
+    for (int c = 0; c < rst.nets[n].nroute.numSegs; c++) {
+        write_segment(out, rst, rst.nets[n].nroute.segments[c]);
+    }
+    out.reserve();
+    out.put('!');
+    out.put('\n');
+}
+
+void write_nets(OutputBuffer &out, const RoutingInst &rst, int first, int last, const OutputPrefetch *prefetch) {
+    for (int n = first; n < last; n++) {
+        if (prefetch != nullptr && prefetch->ready[n]) {
+            out.put_text(prefetch->text[n]);
+        } else {
+            write_net(out, rst, n);
+        }
+    }
+}
+
+void OutputPrefetch::restart(const RoutingInst &rst, const vector<char> &touched) {
+    stop();
+
+    text.resize(size_t(rst.numNets));
+    ready.resize(size_t(rst.numNets), 0);
+    skip = touched;
+    for (int n = 0; n < rst.numNets; n++) {
+        if (skip[n] && ready[n]) {
+            ready[n] = 0;
+            string().swap(text[n]);
+        }
+    }
+
+    worker = std::thread([this, &rst]() {
+        OutputBuffer buffer;
+        for (int n = 0; n < rst.numNets; n++) {
+            if (stopping.load(std::memory_order_relaxed)) return;
+            if (skip[n] || ready[n]) continue;
+
+            write_net(buffer, rst, n);
+            buffer.write_to(text[n]);
+            ready[n] = 1;
+        }
+    });
+}
+
+void OutputPrefetch::stop() {
+    if (worker.joinable()) {
+        stopping = true;
+        worker.join();
+        stopping = false;
+    }
+}
+
+size_t OutputPrefetch::bytes() const {
+    size_t bytes = text.capacity() * sizeof(string) + ready.capacity() + skip.capacity();
+    for (const string &t : text) {
+        bytes += t.capacity();
+    }
+    return bytes;
+}
+
+// Nets handed to each thread per round. Bounds how much text is held in memory.
+const int OUTPUT_CHUNK_NETS = 4096;
+
+// Binary route files: a RouteFileHeader, then for each net
+//   varint numSegs
+//   for each segment: varint numEdges, then the deltas between consecutive edges
+//   in the net (the first one from 0), run-length encoded as pairs of varints:
+//   zigzag(delta), repeat count. A straight wire is a single run.
+// Edges are stored as row-major edge indices, ((y*gx + x) << 1) | vertical,
+// so files don't depend on how RoutingInst happens to index its grid.
+const char ROUTE_FILE_MAGIC[8] = {'S', 'I', 'R', 'O', 'U', 'T', 'E', 0};
+const uint32_t ROUTE_FILE_VERSION = 1;
+
+struct RouteFileHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t gx, gy, numNets;
+};
+
+inline void put_varint(string &out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+inline uint32_t zigzag(int value) {
+    return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+}
+
+inline int unzigzag(uint32_t value) {
+    return int(value >> 1) ^ -int(value & 1);
+}
+
+void encode_nets(string &out, const RoutingInst &rst, int first, int last) {
+    for (int n = first; n < last; n++) {
+        const Route &route = rst.nets[n].nroute;
+        put_varint(out, uint32_t(route.numSegs));
+
+        int prev = 0;
+        for (int s = 0; s < route.numSegs; s++) {
+            const Segment &seg = route.segments[s];
+            put_varint(out, uint32_t(seg.numEdges));
+
+            int c = 0;
+            while (c < seg.numEdges) {
+                int edge = rst.file_edge(seg.edges[c]);
+                int delta = edge - prev;
+                int run = 1;
+                prev = edge;
+                for (c++; c < seg.numEdges; c++, run++) {
+                    edge = rst.file_edge(seg.edges[c]);
+                    if (edge - prev != delta) break;
+                    prev = edge;
+                }
+                put_varint(out, zigzag(delta));
+                put_varint(out, uint32_t(run));
+            }
+        }
+    }
+}
+
+void writeOutput(ostream &out, RoutingInst &rst, const OutputPrefetch *prefetch, OutputFormat format){
     if (!out) {
         cerr << "Bad output file" << endl;
         exit(1);
     }
 
-    for (int n = 0; n < rst.numNets; n++) {
-        out << 'n' << n << endl;
-        for (int c = 0; c < rst.nets[n].nroute.numSegs; c++) {
-            write_segment(out, rst, rst.nets[n].nroute.segments[c]);
+    int threads = std::min(hardware_threads(), (rst.numNets + OUTPUT_CHUNK_NETS - 1) / OUTPUT_CHUNK_NETS);
+    if (threads <= 1 && format == OUTPUT_TEXT) {
+        OutputBuffer buffer(&out);
+        write_nets(buffer, rst, 0, rst.numNets, prefetch);
+        buffer.flush();
+        out.flush();
+        return;
+    }
+    threads = std::max(threads, 1);
+
+    if (format == OUTPUT_BINARY) {
+        RouteFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, ROUTE_FILE_MAGIC, sizeof(header.magic));
+        header.version = ROUTE_FILE_VERSION;
+        header.gx = rst.gx;
+        header.gy = rst.gy;
+        header.numNets = rst.numNets;
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    }
+
+    // Each round, every thread encodes the next chunk of nets into its own buffer.
+    // Then the buffers are written in thread order, so the file comes out in net order.
+    vector<OutputBuffer> buffers(threads);
+    vector<string> packed(threads);
+    for (int round = 0; round < rst.numNets; round += threads * OUTPUT_CHUNK_NETS) {
+        run_threads(threads, [&](int t) {
+            int first = std::min(rst.numNets, round + t * OUTPUT_CHUNK_NETS);
+            int last = std::min(rst.numNets, first + OUTPUT_CHUNK_NETS);
+            if (format == OUTPUT_BINARY) {
+                packed[t].clear();
+                encode_nets(packed[t], rst, first, last);
+            } else {
+                write_nets(buffers[t], rst, first, last, prefetch);
+                if (format == OUTPUT_GZIP) buffers[t].gzip_to(packed[t]);
+            }
+        });
+        for (int t = 0; t < threads; t++) {
+            if (format == OUTPUT_TEXT) {
+                buffers[t].write_to(out);
+            } else {
+                out.write(packed[t].data(), packed[t].size());
+            }
+        }
+    }
+    out.flush();
+}
+
+// Buffered byte reader over gzread, which also reads uncompressed files as-is.
+struct GzReader {
+    gzFile in;
+    vector<char> buffer;
+    size_t pos = 0;
+    size_t len = 0;
+
+    GzReader(gzFile in) : in(in), buffer(OutputBuffer::CAPACITY) {}
+
+    // returns the number of bytes read, less than size only at the end of the file
+    size_t read(char *dst, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            if (pos == len && !refill()) break;
+            size_t n = std::min(size - done, len - pos);
+            memcpy(dst + done, buffer.data() + pos, n);
+            pos += n;
+            done += n;
+        }
+        return done;
+    }
+
+    inline uint32_t varint() {
+        uint32_t value = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (pos == len && !refill()) fail("Truncated route file");
+            uint8_t byte = uint8_t(buffer[pos++]);
+            value |= uint32_t(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) return value;
+        }
+        fail("Corrupt route file");
+        return 0;
+    }
+
+    bool refill() {
+        int n = gzread(in, buffer.data(), unsigned(buffer.size()));
+        if (n < 0) {
+            int errnum;
+            fail(gzerror(in, &errnum));
+        }
+        pos = 0;
+        len = size_t(n);
+        return n > 0;
+    }
+};
+
+void decode_binary(GzReader &in, ostream &out) {
+    RouteFileHeader header;
+    if (in.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header))
+        return fail("Truncated route file");
+    if (header.version != ROUTE_FILE_VERSION) return fail("Unsupported route file version");
+    if (header.gx <= 0 || header.gy <= 0 || header.numNets < 0) return fail("Corrupt route file");
+
+    // only the grid size is needed to turn edges back into points
+    RoutingInst rst;
+    rst.gx = header.gx;
+    rst.gy = header.gy;
+    rst.grid.resize(rst.gx, rst.gy);
+    long max_edge = 2L * header.gx * header.gy;
+
+    OutputBuffer buffer(&out);
+    vector<int> edges;
+    for (int n = 0; n < header.numNets; n++) {
+        buffer.reserve();
+        buffer.put('n');
+        buffer.put_int(n);
+        buffer.put('\n');
+
+        int numSegs = int(in.varint());
+        int prev = 0;
+        for (int s = 0; s < numSegs; s++) {
+            Segment seg;
+            seg.numEdges = int(in.varint());
+            edges.resize(size_t(seg.numEdges));
+            int c = 0;
+            while (c < seg.numEdges) {
+                int delta = unzigzag(in.varint());
+                int run = int(in.varint());
+                if (run <= 0 || run > seg.numEdges - c) return fail("Corrupt route file");
+                for (; run > 0; run--, c++) {
+                    int edge = prev + delta;
+                    if (edge < 0 || edge >= max_edge) return fail("Corrupt route file");
+                    edges[c] = rst.memory_edge(edge);
+                    prev = edge;
+                }
+            }
+            seg.edges = edges.data();
+            write_segment(buffer, rst, seg);
         }
-        out << '!' << endl;
+
+        buffer.reserve();
+        buffer.put('!');
+        buffer.put('\n');
     }
+    buffer.flush();
 }
 
+void decodeOutput(const char *fileName, ostream &out) {
+    // gzread passes uncompressed files through untouched
+    gzFile file = gzopen(fileName, "rb");
+    if (file == nullptr) {
+        cerr << "Bad input file" << endl;
+        exit(1);
+    }
+    gzbuffer(file, 1 << 20);
+    GzReader in(file);
+
+    // binary routes get converted, anything else is already text
+    char magic[sizeof(ROUTE_FILE_MAGIC)];
+    size_t len = in.read(magic, sizeof(magic));
+    if (len == sizeof(magic) && memcmp(magic, ROUTE_FILE_MAGIC, sizeof(magic)) == 0) {
+        in.pos = 0; // the header is still in the buffer
+        decode_binary(in, out);
+    } else {
+        out.write(magic, len);
+        while (in.pos < in.len || in.refill()) {
+            out.write(in.buffer.data() + in.pos, in.len - in.pos);
+            in.pos = in.len;
+        }
+    }
+
+    gzclose(file);
+    out.flush();
+}
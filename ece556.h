@@ -5,9 +5,19 @@
 #define ECE556_H
 
 #include <assert.h>
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <string>
+#include <thread>
 #include <unordered_set>
-#include <unordered_map>
+#include <vector>
+
+#include "edge_counts.h"
+#include "edge_nets.h"
+#include "edge_state.h"
+#include "grid_index.h"
+#include "pool.h"
 
 /**
  * A structure to represent a 2D Point.
@@ -31,23 +41,15 @@ inline std::ostream &operator<<(std::ostream &out, const Point &p) {
 
 /**
  * A structure to represent a segment
+ * The edges live in RoutingInst::pool, so a Segment is just a view of them:
+ * copying one copies the pointer, and nothing is freed when it goes away.
  */
 struct Segment {
     Point p1 ; 	/* start point of a segment */
     Point p2 ; 	/* end point of a segment */
 
-    int numEdges ; 	/* number of edges in the segment*/
-    int *edges ;  	/* array of edges representing the segment*/
-
-    inline Segment &operator=(const Segment &other) {
-        numEdges = other.numEdges;
-        edges = new int[numEdges];
-        for (int e = 0; e < numEdges; e++) {
-            edges[e] = other.edges[e];
-        }
-
-        return *this;
-    }
+    int numEdges = 0; 	    /* number of edges in the segment*/
+    int *edges = nullptr;  	/* array of edges representing the segment*/
 };
 
 inline std::ostream &operator<<(std::ostream &out, const Segment &s) {
@@ -57,25 +59,17 @@ inline std::ostream &operator<<(std::ostream &out, const Segment &s) {
 
 /**
  * A structure to represent a route
+ * Like Segment, a view of segments that live in RoutingInst::pool.
  */
 struct Route {
-    int numSegs ;  	/* number of segments in a route*/
-    Segment *segments ;  /* an array of segments (note, a segment may be flat, L-shaped or any other shape, based on your preference */
-
-    Route &operator=(const Route &other) {
-        numSegs = other.numSegs;
-        segments = new Segment[numSegs];
-        for (int s = 0; s < numSegs; s++) {
-            segments[s] = other.segments[s];
-        }
-
-        return *this;
-    }
+    int numSegs = 0;  	        /* number of segments in a route*/
+    Segment *segments = nullptr;  /* an array of segments (note, a segment may be flat, L-shaped or any other shape, based on your preference */
 };
 
 
 /**
  * A structure to represent nets
+ * Move-only: two copies of a net would share one route but count its edges twice.
  */
 struct Net {
     int id ; 		    /* ID of the net */ // TODO: is this really necessary?
@@ -83,11 +77,16 @@ struct Net {
     Point *pins ; 		/* array of pins (or terminals) of the net. */
     Route nroute ;		/* stored route for the net. */
 
-    std::unordered_map<int, int> routed_edges; // reference counted xD
+    EdgeCounts routed_edges; // reference counted xD
+
+    Net() = default;
+    Net(const Net &) = delete;
+    Net &operator=(const Net &) = delete;
+    Net(Net &&) = default;
+    Net &operator=(Net &&) = default;
 };
 
-// THE CODE DEPENDS ON THIS STRUCTURE FOR A CELL!!!
-// DO NOT MODIFY.
+// A value for the edge to the right of and the edge below a cell
 struct Cell {
     int right = 0;
     int down = 0;
@@ -106,66 +105,50 @@ struct RoutingInst {
     Net *nets = nullptr;		/* array of nets */
 
     int numCells = -1; 	/* number of cells in the grid */
-    Cell *utilization = nullptr;
-    Cell *virtual_cap = nullptr;
+    GridIndex grid;     /* how cells are numbered */
+    EdgeState edges;    /* utilization and virtual capacity of each edge */
+    EdgeNets edge_nets; /* the nets routed over each edge */
+
+    Pool pool;          /* pins, segments and edge arrays of all the nets */
 
     inline int index(const int x, const int y) const {
-        // naive row-major scheme for now...
-        // TODO: morton curve or something better for traversing
         //assert(valid(x, y)); // this breaks A* (but it's safe, I promise!)
-        return y * gx + x;
+        return grid.index(x, y);
     }
     inline int edge_index(const int x, const int y, bool horz) const {
         return (index(x, y) << 1) | (horz ? 0 : 1);
     }
 
     inline Point point(const int idx) const {
-        return Point{idx % gx, idx / gx};
+        return Point{grid.x(idx), grid.y(idx)};
     }
     inline Point point_from_edge(const int edge) const {
         return point(edge >> 1);
     }
     // converts edge idx -> point idx
-    inline int end(int edge) {
-        return (edge >> 1) + ((edge & 1) ? gx : 1);
+    inline int end(int edge) const {
+        return (edge & 1) ? grid.below(edge >> 1) : grid.right(edge >> 1);
     }
 
-    inline Cell &util(const int x, const int y) {
-        return utilization[index(x, y)];
-    }
-    inline const Cell &util(const int x, const int y) const {
-        return utilization[index(x, y)];
-    }
-    inline Cell &util(const Point &p) {
-        return util(p.x, p.y);
+    // Row-major edge indices, ((y*gx + x) << 1) | vertical, for anything
+    // that outlives the process and so can't depend on the grid index scheme
+    inline int file_edge(const int edge) const {
+        Point p = point_from_edge(edge);
+        return ((p.y * gx + p.x) << 1) | (edge & 1);
     }
-    inline const Cell &util(const Point &p) const {
-        return util(p.x, p.y);
-    }
-    inline int &util(const int index) {
-        return reinterpret_cast<int *>(utilization)[index];
-    }
-    inline const int &util(const int index) const {
-        return reinterpret_cast<const int *>(utilization)[index];
+    inline int memory_edge(const int file_edge) const {
+        int idx = file_edge >> 1;
+        return edge_index(idx % gx, idx / gx, (file_edge & 1) == 0);
     }
 
-    inline Cell &vcap(const int x, const int y) {
-        return virtual_cap[index(x, y)];
-    }
-    inline const Cell &vcap(const int x, const int y) const {
-        return virtual_cap[index(x, y)];
+    inline int numEdges() const {
+        return edges.size();
     }
-    inline Cell &vcap(const Point &p) {
-        return vcap(p.x, p.y);
+    inline int util(const int edge) const {
+        return edges.util(edge);
     }
-    inline const Cell &vcap(const Point &p) const {
-        return vcap(p.x, p.y);
-    }
-    inline int &vcap(const int index) {
-        return reinterpret_cast<int *>(virtual_cap)[index];
-    }
-    inline const int &vcap(const int index) const {
-        return reinterpret_cast<const int *>(virtual_cap)[index];
+    inline int vcap(const int edge) const {
+        return edges.vcap(edge);
     }
 
     inline bool valid(int x, int y) const {
@@ -183,57 +166,91 @@ struct RoutingInst {
 };
 
 /**
- * The information needed to restore a RoutingInst
+ * Undo log for one rip-up and reroute iteration. Rather than copying every
+ * route up front in case the iteration makes things worse, it holds on to
+ * the old edges of just the segments that get ripped up. The entry list
+ * keeps its capacity and the pool recycles the edge arrays, so after the
+ * first iteration checkpointing allocates nothing.
  */
-struct RoutingSolution {
-    int numNets = -1;	/* number of nets */
-    Net *nets = nullptr;		/* array of nets */
+struct RouteJournal {
+    // Rips up the segment's edges but keeps them for rollback
+    void ripup(RoutingInst &rst, Net &net, Segment &seg);
+
+    // Rips up the whole route, leaving the net with no segments, but keeps
+    // it for rollback
+    void ripup(RoutingInst &rst, Net &net);
+
+    // Keeps the current routes and gives the old edges back to the pool
+    void commit(RoutingInst &rst);
+
+    // Reroutes everything ripped up since the last commit the way it was
+    void rollback(RoutingInst &rst);
+
+    // The entry list and the old edges it's holding on to
+    size_t bytes() const;
+
+private:
+    struct Entry {
+        Net *net;
+        Segment *seg; /* null if the whole route was ripped up */
+        int numEdges; /* the old route of seg */
+        int *edges;
+        Route route;  /* the old route of the net, if seg is null */
+    };
+    std::vector<Entry> entries;
+};
 
-    int numCells = -1; 	/* number of cells in the grid */
-    Cell *utilization = nullptr;
-
-    inline void clone(const RoutingInst &other) {
-        numNets = other.numNets;
-        nets = new Net[numNets];
-        for (int n = 0; n < numNets; n++) {
-            nets[n].nroute = other.nets[n].nroute;
-        }
-
-        numCells = other.numCells;
-        utilization = new Cell[numCells];
-        for (int c = 0; c < numCells; c++) {
-            utilization[c] = other.utilization[c];
-        }
-    }
+/**
+ * Output text for nets, serialized ahead of time on a background thread
+ * while rip-up and reroute is still running. Each RUARR iteration restarts
+ * it with the nets it's about to rip up. The rest can't change during that
+ * iteration, whether it's kept or rolled back, so they're safe to write early.
+ */
+struct OutputPrefetch {
+    std::vector<std::string> text; /* serialized text of each net */
+    std::vector<char> ready;       /* whether text[n] matches the current route */
 
-    inline void destroy() {
-        if (nets != nullptr) {
-            for (int n = 0; n < numNets; n++) {
-                for (int s = 0; s < nets[n].nroute.numSegs; s++) {
-                    delete [] nets[n].nroute.segments[s].edges;
-                }
-                delete [] nets[n].nroute.segments;
-            }
-            delete [] nets;
-        }
-
-        if (utilization != nullptr) {
-            delete[] utilization;
-        }
-    }
+    // Stops the background thread, forgets the text of the touched nets,
+    // and starts serializing every other net that isn't ready yet.
+    void restart(const RoutingInst &rst, const std::vector<char> &touched);
 
-    void restore(RoutingInst &other) {
-        std::swap(numNets, other.numNets);
-        std::swap(nets, other.nets);
-        std::swap(numCells, other.numCells);
-        std::swap(utilization, other.utilization);
-    }
+    // Stops the background thread. Must be called before nets are modified
+    // by anything other than the iteration that started it.
+    void stop();
 
-    ~RoutingSolution() {
-        destroy();
+    // Text serialized so far. Only meaningful once stopped.
+    size_t bytes() const;
+
+    ~OutputPrefetch() {
+        stop();
     }
+
+private:
+    std::vector<char> skip;
+    std::thread worker;
+    std::atomic<bool> stopping{false};
 };
 
+/**
+ * The formats writeOutput can produce. decodeOutput turns any of them back into text.
+ */
+enum OutputFormat {
+    OUTPUT_TEXT,   /* the text format the evaluation script reads */
+    OUTPUT_GZIP,   /* the same text, gzipped in independent blocks */
+    OUTPUT_BINARY, /* each net's edge indices as varint deltas */
+};
+
+/* void startLoadingFlute()
+   Start reading FLUTE's lookup tables on a background thread.
+   Call this as early as possible; flute() users wait for it with waitForFlute().
+*/
+void startLoadingFlute();
+
+/* void waitForFlute()
+   Block until FLUTE's tables are loaded, loading them now if nobody started it.
+*/
+void waitForFlute();
+
 /* int readBenchmark(const char *fileName, routingInst *rst)
    Read in the benchmark file and initialize the routing instance.
    This function needs to populate all fields of the routingInst structure.
@@ -242,14 +259,41 @@ struct RoutingSolution {
 */
 void readBenchmark(std::istream &in, RoutingInst &rst);
 
+/* void readBenchmark(const char *fileName, RoutingInst &rst)
+   Same as above, but memory-maps the file and tokenizes it in place.
+   Falls back to the stream version if the file can't be mapped.
+   input1: fileName: Name of the benchmark input file
+   input2: the routing instance
+*/
+void readBenchmark(const char *fileName, RoutingInst &rst);
+
+/* bool readBenchmarkCache(const char *cacheFileName, const char *sourceFileName, RoutingInst &rst)
+   Load a routing instance from a binary snapshot made by writeBenchmarkCache.
+   The snapshot is memory-mapped and the pins are used in place.
+   input1: cacheFileName: the snapshot
+   input2: sourceFileName: the benchmark it was made from
+   input3: the routing instance
+   output: false if the cache is missing, corrupt, or older than the benchmark
+*/
+bool readBenchmarkCache(const char *cacheFileName, const char *sourceFileName, RoutingInst &rst);
+
+/* void writeBenchmarkCache(const char *cacheFileName, const char *sourceFileName, const RoutingInst &rst)
+   Snapshot a freshly read routing instance (before routing!) for readBenchmarkCache.
+   input1: cacheFileName: where to put the snapshot
+   input2: sourceFileName: the benchmark it was read from
+   input3: the routing instance
+*/
+void writeBenchmarkCache(const char *cacheFileName, const char *sourceFileName, const RoutingInst &rst);
+
 
 /* int solveRouting(routingInst *rst)
    This function creates a routing solution
    input1: pointer to the routing instance
    input2: time at which the routing must be finished
    input3: whether to do shitty net decomposition
+   input4: optional, serializes finished nets in the background during RUARR
 */
-void solveRouting(RoutingInst &rst, time_t time_limit, bool shitty_initial);
+void solveRouting(RoutingInst &rst, time_t time_limit, bool shitty_initial, OutputPrefetch *prefetch = nullptr);
 
 /* int writeOutput(const char *outRouteFile, routingInst *rst)
    Write the routing solution obtained from solveRouting(). 
@@ -261,9 +305,27 @@ void solveRouting(RoutingInst &rst, time_t time_limit, bool shitty_initial);
 
    input1: the output file
    input2: pointer to the routing instance
+   input3: optional, text already serialized by solveRouting
+   input4: the file format, see OutputFormat
    output: 1 if successful, 0 otherwise 
   */
-void writeOutput(std::ostream &out, RoutingInst &rst);
+void writeOutput(std::ostream &out, RoutingInst &rst, const OutputPrefetch *prefetch = nullptr, OutputFormat format = OUTPUT_TEXT);
+
+/* void decodeOutput(const char *fileName, std::ostream &out)
+   Read back a file written by writeOutput, in any format, as plain text.
+   input1: the routed output file
+   input2: where to write the text
+*/
+void decodeOutput(const char *fileName, std::ostream &out);
+
+/* void reportMemory(const char *phase, const RoutingInst &rst, ...)
+   Print the bytes held by each part of the router and the process's peak RSS.
+   input1: what just finished, e.g. "parse"
+   input2: the routing instance
+   input3: optional, the RUARR undo journal
+   input4: optional, output text serialized ahead of time (must be stopped)
+*/
+void reportMemory(const char *phase, const RoutingInst &rst, const RouteJournal *journal = nullptr, const OutputPrefetch *prefetch = nullptr);
 
 
 #endif // ECE556_H
@@ -0,0 +1,127 @@
+//
+// Flat hash table of the edges used by one net.
+//
+
+#ifndef SILICON_EDGE_COUNTS_H
+#define SILICON_EDGE_COUNTS_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Reference counts for the edges a net is routed on (several segments of
+ * one net may share an edge). Open addressing with linear probing, with
+ * each count stored right next to its key, so a lookup is usually one
+ * cache line and never a pointer chase. Deletion shifts entries back
+ * rather than leaving tombstones, so probes stay short across rip-ups.
+ * Each entry also carries the net's node in RoutingInst::edge_nets.
+ */
+class EdgeCounts {
+public:
+    // Number of edges, not references
+    inline int size() const {
+        return used;
+    }
+
+    // Size of the table, which is kept at least twice the edges in it
+    inline size_t bytes() const {
+        return slots.capacity() * sizeof(Slot);
+    }
+
+    inline bool contains(int edge) const {
+        return find(edge) >= 0;
+    }
+
+    // Adds a reference to the edge. If the net wasn't using it yet, returns
+    // where to store its node, otherwise nullptr.
+    inline int *add(int edge) {
+        assert(edge >= 0);
+        if ((used + 1) * 2 > int(slots.size())) grow();
+
+        uint32_t mask = uint32_t(slots.size() - 1);
+        for (uint32_t i = home(edge); ; i = (i + 1) & mask) {
+            if (slots[i].edge == edge) {
+                slots[i].count++;
+                return nullptr;
+            }
+            if (slots[i].edge == EMPTY) {
+                slots[i].edge = edge;
+                slots[i].count = 1;
+                used++;
+                return &slots[i].node;
+            }
+        }
+    }
+
+    // Drops a reference to the edge. If that was the last one, returns the
+    // node that was stored for it, otherwise -1.
+    inline int remove(int edge) {
+        int i = find(edge);
+        assert(i >= 0);
+        if (--slots[i].count > 0) return -1;
+        int node = slots[i].node;
+
+        // backward shift: pull later entries of the probe run into the hole
+        uint32_t mask = uint32_t(slots.size() - 1);
+        uint32_t hole = uint32_t(i);
+        for (uint32_t j = (hole + 1) & mask; slots[j].edge != EMPTY; j = (j + 1) & mask) {
+            uint32_t k = home(slots[j].edge);
+            if (((j - k) & mask) >= ((j - hole) & mask)) {
+                slots[hole] = slots[j];
+                hole = j;
+            }
+        }
+        slots[hole].edge = EMPTY;
+        used--;
+        return node;
+    }
+
+private:
+    static const int EMPTY = -1;
+    static const int MIN_SLOTS = 16;
+
+    struct Slot {
+        int edge;
+        int count;
+        int node;
+    };
+
+    inline uint32_t home(int edge) const {
+        // fibonacci hashing, since a net's edges are mostly runs of nearby indices
+        return (uint32_t(edge) * 2654435769u) >> shift;
+    }
+
+    inline int find(int edge) const {
+        if (slots.empty()) return -1;
+        uint32_t mask = uint32_t(slots.size() - 1);
+        for (uint32_t i = home(edge); ; i = (i + 1) & mask) {
+            if (slots[i].edge == edge) return int(i);
+            if (slots[i].edge == EMPTY) return -1;
+        }
+    }
+
+    void grow() {
+        std::vector<Slot> old;
+        old.swap(slots);
+
+        size_t count = old.empty() ? MIN_SLOTS : old.size() * 2;
+        slots.assign(count, Slot{EMPTY, 0, -1});
+        shift = 32;
+        for (size_t c = count; c > 1; c >>= 1) shift--;
+
+        uint32_t mask = uint32_t(count - 1);
+        for (const Slot &slot : old) {
+            if (slot.edge == EMPTY) continue;
+            uint32_t i = home(slot.edge);
+            while (slots[i].edge != EMPTY) i = (i + 1) & mask;
+            slots[i] = slot;
+        }
+    }
+
+    std::vector<Slot> slots; // size is zero or a power of two
+    int used = 0;
+    int shift = 32;
+};
+
+#endif //SILICON_EDGE_COUNTS_H
@@ -0,0 +1,87 @@
+//
+// Which nets are routed over each edge.
+//
+
+#ifndef SILICON_EDGE_NETS_H
+#define SILICON_EDGE_NETS_H
+
+#include <assert.h>
+#include <vector>
+
+#include "huge_pages.h"
+
+/**
+ * A doubly linked list of nets for every edge, with all the nodes in one
+ * array. Each net's EdgeCounts remembers the node it has on each of its
+ * edges, so unlinking is O(1) and use_edge/ripup_edge can keep this up to
+ * date for free. Freed nodes are reused before the array grows.
+ */
+class EdgeNets {
+public:
+    enum { NONE = -1 };
+
+    inline void resize(int numEdges) {
+        heads.assign(size_t(numEdges), NONE);
+        nodes.clear();
+        free_nodes = NONE;
+    }
+
+    inline size_t bytes() const {
+        return heads.capacity() * sizeof(int) + nodes.capacity() * sizeof(Node);
+    }
+
+    // Links the net onto the edge and returns its node
+    inline int add(int edge, int net) {
+        int node;
+        if (free_nodes != NONE) {
+            node = free_nodes;
+            free_nodes = nodes[node].next;
+        } else {
+            node = int(nodes.size());
+            nodes.emplace_back();
+        }
+
+        nodes[node].net = net;
+        nodes[node].prev = NONE;
+        nodes[node].next = heads[edge];
+        if (heads[edge] != NONE) nodes[heads[edge]].prev = node;
+        heads[edge] = node;
+        return node;
+    }
+
+    // Unlinks a node that add() returned for this edge
+    inline void remove(int edge, int node) {
+        Node &n = nodes[node];
+        if (n.prev != NONE) {
+            nodes[n.prev].next = n.next;
+        } else {
+            assert(heads[edge] == node);
+            heads[edge] = n.next;
+        }
+        if (n.next != NONE) nodes[n.next].prev = n.prev;
+
+        n.next = free_nodes;
+        free_nodes = node;
+    }
+
+    // Calls fn(net) for every net routed over the edge
+    template<typename F>
+    inline void for_each(int edge, F fn) const {
+        for (int node = heads[edge]; node != NONE; node = nodes[node].next) {
+            fn(nodes[node].net);
+        }
+    }
+
+private:
+    struct Node {
+        int net;
+        int prev;
+        int next; // also links the free list
+    };
+
+    GridVector<int> heads; // first node of each edge
+    GridVector<Node> nodes;
+    int free_nodes = NONE;
+};
+
+#endif //SILICON_EDGE_NETS_H
@@ -0,0 +1,161 @@
+//
+// Utilization and virtual capacity of every edge in the routing grid.
+//
+
+#ifndef SILICON_EDGE_STATE_H
+#define SILICON_EDGE_STATE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "huge_pages.h"
+
+// How EdgeState lays out its memory. Pick one at compile time with
+// -DEDGE_LAYOUT=... (or `make EDGE_LAYOUT=...`); edge indices don't change.
+#define EDGE_LAYOUT_SPLIT  0 // a util array and a vcap array, right/down edges interleaved
+#define EDGE_LAYOUT_PACKED 1 // util and vcap of each edge side by side
+#define EDGE_LAYOUT_PLANES 2 // util and vcap arrays for horizontal and vertical edges separately
+
+#ifndef EDGE_LAYOUT
+#define EDGE_LAYOUT EDGE_LAYOUT_PACKED
+#endif
+
+// Width of the per-edge counters, 32 or 16 (`make EDGE_COUNTER_BITS=16`).
+// 16 halves the grid state; a count that doesn't fit stops the router.
+#ifndef EDGE_COUNTER_BITS
+#define EDGE_COUNTER_BITS 32
+#endif
+
+#if EDGE_COUNTER_BITS == 16
+typedef uint16_t UtilCount;
+typedef int16_t VcapCount; // virtual capacity goes negative on badly overflowed edges
+#else
+typedef int UtilCount;
+typedef int VcapCount;
+#endif
+
+/**
+ * Routing state per edge, addressed by edge index ((cell << 1) | vertical).
+ * The cost functions read util and vcap of the same edge together, so the
+ * packed layout gets both from one cache line; the others are kept around
+ * for comparing (see `make bench-layouts`).
+ * Values go in and out as ints and are checked against the counter type on
+ * the way in, which is free with 32-bit counters. One that doesn't fit is
+ * fatal: clamping it would undercount the edge once it's ripped up again.
+ */
+class EdgeState {
+public:
+    static const int MAX_UTIL = std::numeric_limits<UtilCount>::max();
+    static const int MAX_VCAP = std::numeric_limits<VcapCount>::max();
+
+    // Every edge starts unused with a virtual capacity of cap
+    inline void resize(int numEdges, int cap) {
+        count = numEdges;
+        VcapCount vcap = fit<VcapCount>(cap);
+#if EDGE_LAYOUT == EDGE_LAYOUT_PACKED
+        edges.assign(size_t(numEdges), Edge{0, vcap});
+#elif EDGE_LAYOUT == EDGE_LAYOUT_SPLIT
+        utils.assign(size_t(numEdges), 0);
+        vcaps.assign(size_t(numEdges), vcap);
+#else
+        for (int dir = 0; dir < 2; dir++) {
+            utils[dir].assign(size_t(numEdges + 1) / 2, 0);
+            vcaps[dir].assign(size_t(numEdges + 1) / 2, vcap);
+        }
+#endif
+    }
+
+    inline int size() const {
+        return count;
+    }
+
+    inline size_t bytes() const {
+#if EDGE_LAYOUT == EDGE_LAYOUT_PACKED
+        return edges.capacity() * sizeof(Edge);
+#elif EDGE_LAYOUT == EDGE_LAYOUT_SPLIT
+        return utils.capacity() * sizeof(UtilCount) + vcaps.capacity() * sizeof(VcapCount);
+#else
+        return (utils[0].capacity() + utils[1].capacity()) * sizeof(UtilCount) +
+               (vcaps[0].capacity() + vcaps[1].capacity()) * sizeof(VcapCount);
+#endif
+    }
+
+    inline int util(int edge) const {
+        return util_slot(edge);
+    }
+    inline void set_util(int edge, int value) {
+        util_slot(edge) = fit<UtilCount>(value);
+    }
+    inline void add_util(int edge, int delta) {
+        UtilCount &slot = util_slot(edge);
+        slot = fit<UtilCount>(int(slot) + delta);
+    }
+
+    inline int vcap(int edge) const {
+        return vcap_slot(edge);
+    }
+    inline void set_vcap(int edge, int value) {
+        vcap_slot(edge) = fit<VcapCount>(value);
+    }
+
+    static inline const char *layout_name() {
+#if EDGE_LAYOUT == EDGE_LAYOUT_PACKED
+        return "packed";
+#elif EDGE_LAYOUT == EDGE_LAYOUT_SPLIT
+        return "split";
+#else
+        return "planes";
+#endif
+    }
+
+private:
+    template<typename T>
+    static inline T fit(int value) {
+        const int lo = std::numeric_limits<T>::min();
+        const int hi = std::numeric_limits<T>::max();
+        if (sizeof(T) < sizeof(int) && (value < lo || value > hi)) {
+            fprintf(stderr, "ERROR: Edge count %d doesn't fit in the edge counters, rebuild with EDGE_COUNTER_BITS=32\n", value);
+            exit(1);
+        }
+        return T(value);
+    }
+
+#if EDGE_LAYOUT == EDGE_LAYOUT_PACKED
+    inline UtilCount &util_slot(int edge)             { return edges[edge].util; }
+    inline const UtilCount &util_slot(int edge) const { return edges[edge].util; }
+    inline VcapCount &vcap_slot(int edge)             { return edges[edge].vcap; }
+    inline const VcapCount &vcap_slot(int edge) const { return edges[edge].vcap; }
+#elif EDGE_LAYOUT == EDGE_LAYOUT_SPLIT
+    inline UtilCount &util_slot(int edge)             { return utils[edge]; }
+    inline const UtilCount &util_slot(int edge) const { return utils[edge]; }
+    inline VcapCount &vcap_slot(int edge)             { return vcaps[edge]; }
+    inline const VcapCount &vcap_slot(int edge) const { return vcaps[edge]; }
+#else
+    inline UtilCount &util_slot(int edge)             { return utils[edge & 1][edge >> 1]; }
+    inline const UtilCount &util_slot(int edge) const { return utils[edge & 1][edge >> 1]; }
+    inline VcapCount &vcap_slot(int edge)             { return vcaps[edge & 1][edge >> 1]; }
+    inline const VcapCount &vcap_slot(int edge) const { return vcaps[edge & 1][edge >> 1]; }
+#endif
+
+    int count = 0;
+
+#if EDGE_LAYOUT == EDGE_LAYOUT_PACKED
+    struct Edge {
+        UtilCount util;
+        VcapCount vcap;
+    };
+    GridVector<Edge> edges;
+#elif EDGE_LAYOUT == EDGE_LAYOUT_SPLIT
+    GridVector<UtilCount> utils;
+    GridVector<VcapCount> vcaps;
+#else
+    GridVector<UtilCount> utils[2]; // [0] horizontal, [1] vertical, by cell index
+    GridVector<VcapCount> vcaps[2];
+#endif
+};
+
+#endif //SILICON_EDGE_STATE_H
@@ -0,0 +1,169 @@
+//
+// Mapping between grid coordinates and cell indices.
+//
+
+#ifndef SILICON_GRID_INDEX_H
+#define SILICON_GRID_INDEX_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+
+// How cells are numbered. Pick one at compile time with -DGRID_INDEX=...
+// (or `make GRID_INDEX=...`). Anything that leaves the process (output
+// files, the benchmark cache) goes through row-major indices regardless.
+#define GRID_INDEX_ROW_MAJOR 0 // y * gx + x
+#define GRID_INDEX_TILED     1 // 8x8 tiles in row-major order, row-major within a tile
+#define GRID_INDEX_MORTON    2 // Z-order curve
+
+#ifndef GRID_INDEX
+#define GRID_INDEX GRID_INDEX_ROW_MAJOR
+#endif
+
+/**
+ * Numbers the cells of a gx by gy grid so that the maze router's vertical
+ * steps don't each land a whole row away. The tiled and Z-order schemes pad
+ * the grid, so size() can be more than gx * gy; padding cells are never valid.
+ * index() must not crash on coordinates just outside the grid (A* computes
+ * them before checking), but what it returns for them is meaningless.
+ */
+class GridIndex {
+public:
+    inline void resize(int gx, int gy) {
+        width = gx;
+#if GRID_INDEX == GRID_INDEX_ROW_MAJOR
+        cells = gx * gy;
+#elif GRID_INDEX == GRID_INDEX_TILED
+        tiles_x = (gx + TILE - 1) >> TILE_BITS;
+        int tiles_y = (gy + TILE - 1) >> TILE_BITS;
+        cells = (tiles_x * tiles_y) << (2 * TILE_BITS);
+#else
+        // interleave as many bits as the narrower side needs; the rest
+        // of the wider side goes on top, so long thin grids don't pad to a square
+        int bits_x = bits(gx), bits_y = bits(gy);
+        shared_bits = std::min(bits_x, bits_y);
+        assert(shared_bits < 16);
+        wide_x = bits_x > bits_y;
+        int longer = std::max(gx, gy);
+        cells = longer == 0 ? 0 : (((longer - 1) >> shared_bits) + 1) << (2 * shared_bits);
+#endif
+    }
+
+    // Number of indices, including padding
+    inline int size() const {
+        return cells;
+    }
+
+#if GRID_INDEX == GRID_INDEX_ROW_MAJOR
+    inline int index(int x, int y) const {
+        return y * width + x;
+    }
+    inline int x(int idx) const {
+        return idx % width;
+    }
+    inline int y(int idx) const {
+        return idx / width;
+    }
+    inline int right(int idx) const {
+        return idx + 1;
+    }
+    inline int below(int idx) const {
+        return idx + width;
+    }
+#elif GRID_INDEX == GRID_INDEX_TILED
+    inline int index(int x, int y) const {
+        uint32_t ux = uint32_t(x), uy = uint32_t(y);
+        uint32_t tile = (uy >> TILE_BITS) * uint32_t(tiles_x) + (ux >> TILE_BITS);
+        return int((tile << (2 * TILE_BITS)) | ((uy & TILE_MASK) << TILE_BITS) | (ux & TILE_MASK));
+    }
+    inline int x(int idx) const {
+        return (((idx >> (2 * TILE_BITS)) % tiles_x) << TILE_BITS) | (idx & TILE_MASK);
+    }
+    inline int y(int idx) const {
+        return (((idx >> (2 * TILE_BITS)) / tiles_x) << TILE_BITS) | ((idx >> TILE_BITS) & TILE_MASK);
+    }
+    inline int right(int idx) const {
+        return (idx & TILE_MASK) != TILE_MASK ? idx + 1 : index(x(idx) + 1, y(idx));
+    }
+    inline int below(int idx) const {
+        return ((idx >> TILE_BITS) & TILE_MASK) != TILE_MASK ? idx + TILE : index(x(idx), y(idx) + 1);
+    }
+#else
+    inline int index(int x, int y) const {
+        uint32_t ux = uint32_t(x), uy = uint32_t(y);
+        uint32_t mask = (1u << shared_bits) - 1;
+        uint32_t high = (wide_x ? ux : uy) >> shared_bits;
+        return int((high << (2 * shared_bits)) | spread(ux & mask) | (spread(uy & mask) << 1));
+    }
+    inline int x(int idx) const {
+        int low = int(compact(interleaved(idx)));
+        return wide_x ? ((idx >> (2 * shared_bits)) << shared_bits) | low : low;
+    }
+    inline int y(int idx) const {
+        int low = int(compact(interleaved(idx) >> 1));
+        return wide_x ? low : ((idx >> (2 * shared_bits)) << shared_bits) | low;
+    }
+    inline int right(int idx) const {
+        return index(x(idx) + 1, y(idx));
+    }
+    inline int below(int idx) const {
+        return index(x(idx), y(idx) + 1);
+    }
+#endif
+
+    static inline const char *scheme_name() {
+#if GRID_INDEX == GRID_INDEX_ROW_MAJOR
+        return "row-major";
+#elif GRID_INDEX == GRID_INDEX_TILED
+        return "tiled";
+#else
+        return "morton";
+#endif
+    }
+
+private:
+    int width = 0;
+    int cells = 0;
+
+#if GRID_INDEX == GRID_INDEX_TILED
+    static const int TILE_BITS = 3;
+    static const int TILE = 1 << TILE_BITS;
+    static const uint32_t TILE_MASK = TILE - 1;
+    int tiles_x = 0;
+#elif GRID_INDEX == GRID_INDEX_MORTON
+    int shared_bits = 0; // low bits of x and y that are interleaved
+    bool wide_x = false; // whether the remaining high bits are x's (otherwise y's)
+
+    // bits needed for coordinates 0 .. n-1
+    static inline int bits(int n) {
+        int b = 0;
+        while ((1 << b) < n) b++;
+        return b;
+    }
+
+    inline uint32_t interleaved(int idx) const {
+        return uint32_t(idx) & ((1u << (2 * shared_bits)) - 1);
+    }
+
+    // 16 bits -> every other bit of 32
+    static inline uint32_t spread(uint32_t v) {
+        v = (v | (v << 8)) & 0x00FF00FF;
+        v = (v | (v << 4)) & 0x0F0F0F0F;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    }
+
+    // every other bit of 32 -> 16 bits
+    static inline uint32_t compact(uint32_t v) {
+        v &= 0x55555555;
+        v = (v | (v >> 1)) & 0x33333333;
+        v = (v | (v >> 2)) & 0x0F0F0F0F;
+        v = (v | (v >> 4)) & 0x00FF00FF;
+        v = (v | (v >> 8)) & 0x0000FFFF;
+        return v;
+    }
+#endif
+};
+
+#endif //SILICON_GRID_INDEX_H
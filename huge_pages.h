@@ -0,0 +1,135 @@
+//
+// Allocator that backs big arrays with huge pages where it can.
+//
+
+#ifndef SILICON_HUGE_PAGES_H
+#define SILICON_HUGE_PAGES_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+// Whether the grid arrays ask for huge pages, 1 or 0 (`make HUGE_PAGES=0`).
+#ifndef HUGE_PAGES
+#define HUGE_PAGES 1
+#endif
+
+// Bytes HugePageAllocator currently has mapped, by how they're backed. Not thread safe.
+struct HugePageStats {
+    size_t hugetlb = 0;  /* explicit huge pages (MAP_HUGETLB) */
+    size_t advised = 0;  /* normal pages, madvise'd for transparent huge pages */
+    std::vector<void *> hugetlb_maps; /* to tell the two apart again on free */
+
+    static inline HugePageStats &get() {
+        static HugePageStats stats;
+        return stats;
+    }
+};
+
+/**
+ * std::allocator replacement for the per-edge arrays, which A* hits all
+ * over, so that a 2MB page covers what would otherwise be 512 TLB entries.
+ * Explicit huge pages are tried first; they need a reserved pool
+ * (vm.nr_hugepages), so without one it falls back to an ordinary mapping
+ * with MADV_HUGEPAGE, which works whenever transparent huge pages aren't
+ * switched off entirely. Arrays under one huge page just use the heap.
+ */
+template<typename T>
+struct HugePageAllocator {
+    typedef T value_type;
+
+    static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+    HugePageAllocator() {}
+    template<typename U>
+    HugePageAllocator(const HugePageAllocator<U> &) {}
+
+    T *allocate(size_t count) {
+        size_t bytes = count * sizeof(T);
+        if (!HUGE_PAGES || bytes < HUGE_PAGE_SIZE) {
+            return static_cast<T *>(::operator new(bytes));
+        }
+
+        HugePageStats &stats = HugePageStats::get();
+        size_t length = rounded(bytes);
+        void *mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        mem = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            stats.hugetlb += length;
+            stats.hugetlb_maps.push_back(mem);
+            return static_cast<T *>(mem);
+        }
+#endif
+        mem = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+        madvise(mem, length, MADV_HUGEPAGE);
+#endif
+        stats.advised += length;
+        return static_cast<T *>(mem);
+    }
+
+    void deallocate(T *mem, size_t count) {
+        size_t bytes = count * sizeof(T);
+        if (!HUGE_PAGES || bytes < HUGE_PAGE_SIZE) {
+            ::operator delete(mem);
+            return;
+        }
+
+        HugePageStats &stats = HugePageStats::get();
+        size_t length = rounded(bytes);
+        auto it = std::find(stats.hugetlb_maps.begin(), stats.hugetlb_maps.end(), mem);
+        if (it != stats.hugetlb_maps.end()) {
+            stats.hugetlb_maps.erase(it);
+            stats.hugetlb -= length;
+        } else {
+            stats.advised -= length;
+        }
+        munmap(mem, length);
+    }
+
+private:
+    // MAP_HUGETLB mappings must be whole huge pages, so round them all
+    static inline size_t rounded(size_t bytes) {
+        return (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    }
+};
+
+template<typename T, typename U>
+inline bool operator==(const HugePageAllocator<T> &, const HugePageAllocator<U> &) {
+    return true;
+}
+template<typename T, typename U>
+inline bool operator!=(const HugePageAllocator<T> &, const HugePageAllocator<U> &) {
+    return false;
+}
+
+// Vector for per-edge arrays of the grid
+template<typename T>
+using GridVector = std::vector<T, HugePageAllocator<T>>;
+
+// How much of this process's anonymous memory the kernel has actually put
+// on transparent huge pages, in kB, or -1 if it won't say
+inline long anon_huge_pages_kb() {
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    if (f == nullptr) return -1;
+
+    long kb = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        if (strncmp(line, "AnonHugePages:", 14) == 0) {
+            kb = strtol(line + 14, nullptr, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+#endif //SILICON_HUGE_PAGES_H
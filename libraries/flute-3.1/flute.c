@@ -1,7 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "flute.h"
 
 #if D<=7
@@ -49,15 +54,204 @@ DTYPE wirelength(Tree t);
 void printtree(Tree t);
 void plottree(Tree t);
 
+// Binary image of the tables, so later runs can mmap them instead of parsing.
+// It lives next to POWVFILE, and its header records the size and mtime of the
+// text tables it was made from, so editing or replacing them forces a rebuild.
+// Layout: struct lut_header, int numsoln[ngroups], int offset[ngroups],
+// struct csoln soln[nsolns], with the groups in order d=4..D, k=0..numgrp[d]-1.
+// offset[] indexes soln[]; groups that share solutions share an offset.
+#define LUTMAGIC "FLUTELUT"
+#define LUTVERSION 2
+#define LUTPATHSIZE (sizeof(POWVFILE) + sizeof(LUTFILE))
+
+struct lut_source
+{
+    long long size, mtime_sec, mtime_nsec;
+};
+
+struct lut_header
+{
+    char magic[8];
+    int version;
+    int d, routing, solnsize;
+    int ngroups, nsolns;
+    struct lut_source powv, post;  // post is all zero unless ROUTING==1
+};
+
+static int statLUTSources(struct lut_header *h);
+static void lutImagePath(char *path);
+static int readLUTImage(const struct lut_header *sources);
+static void readLUTText(int *nsoln, int *offset, struct csoln **soln, int *nsolns);
+static void writeLUTImage(const struct lut_header *sources, int ngroups, int *nsoln, int *offset, struct csoln *soln, int nsolns);
+static void setLUT(int *nsoln, int *offset, struct csoln *soln);
+
 void readLUT()
+{
+    int d, ngroups, nsolns, *nsoln, *offset, image;
+    struct csoln *soln;
+    struct lut_header sources;
+
+    init_param();
+
+    // stat before parsing, so a table changed mid-parse gets a stale image
+    image = statLUTSources(&sources);
+    if (image && readLUTImage(&sources))
+        return;
+
+    ngroups = 0;
+    for (d=4; d<=D; d++)
+        ngroups += numgrp[d];
+    nsoln = (int *) malloc(ngroups*sizeof(int));
+    offset = (int *) malloc(ngroups*sizeof(int));
+
+    readLUTText(nsoln, offset, &soln, &nsolns);
+    setLUT(nsoln, offset, soln);
+    if (image)
+        writeLUTImage(&sources, ngroups, nsoln, offset, soln, nsolns);
+
+    free(nsoln);
+    free(offset);
+}
+
+static void setLUT(int *nsoln, int *offset, struct csoln *soln)
+{
+    int d, k, g;
+
+    g = 0;
+    for (d=4; d<=D; d++) {
+        for (k=0; k<numgrp[d]; k++, g++) {
+            numsoln[d][k] = nsoln[g];
+            LUT[d][k] = soln + offset[g];
+        }
+    }
+}
+
+static int statLUTSource(const char *name, struct lut_source *src)
+{
+    struct stat st;
+
+    if (stat(name, &st) != 0)
+        return 0;
+    src->size = st.st_size;
+    src->mtime_sec = st.st_mtim.tv_sec;
+    src->mtime_nsec = st.st_mtim.tv_nsec;
+    return 1;
+}
+
+// Fills in the source fields of h. Returns 0 if a table can't be found.
+static int statLUTSources(struct lut_header *h)
+{
+    memset(h, 0, sizeof(*h));
+    if (!statLUTSource(POWVFILE, &h->powv))
+        return 0;
+#if ROUTING==1
+    if (!statLUTSource(POSTFILE, &h->post))
+        return 0;
+#endif
+    return 1;
+}
+
+// The image goes in the same directory as POWVFILE; path holds LUTPATHSIZE.
+static void lutImagePath(char *path)
+{
+    const char *slash = strrchr(POWVFILE, '/');
+    size_t dir = slash == NULL ? 0 : (size_t) (slash - POWVFILE) + 1;
+
+    memcpy(path, POWVFILE, dir);
+    strcpy(path + dir, LUTFILE);
+}
+
+// Returns 0 if there's no usable image, in which case nothing has changed.
+static int readLUTImage(const struct lut_header *sources)
+{
+    struct lut_header h;
+    struct stat st;
+    int fd, d, g, *nsoln, *offset;
+    size_t size;
+    char *map, path[LUTPATHSIZE];
+
+    lutImagePath(path);
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(h)
+        || read(fd, &h, sizeof(h)) != sizeof(h)) {
+        close(fd);
+        return 0;
+    }
+
+    g = 0;
+    for (d=4; d<=D; d++)
+        g += numgrp[d];
+    size = sizeof(h) + 2*g*sizeof(int) + (size_t) h.nsolns*sizeof(struct csoln);
+    if (memcmp(h.magic, LUTMAGIC, sizeof(h.magic)) != 0 || h.version != LUTVERSION
+        || h.d != D || h.routing != ROUTING || h.solnsize != sizeof(struct csoln)
+        || h.ngroups != g || h.nsolns < 0 || (size_t) st.st_size != size
+        || memcmp(&h.powv, &sources->powv, sizeof(h.powv)) != 0
+        || memcmp(&h.post, &sources->post, sizeof(h.post)) != 0) {
+        close(fd);
+        return 0;
+    }
+
+    map = (char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+
+    nsoln = (int *) (map + sizeof(h));
+    offset = nsoln + g;
+    for (g=0; g<h.ngroups; g++) {
+        if (offset[g] < 0 || offset[g] + nsoln[g] > h.nsolns) {
+            munmap(map, size);
+            return 0;
+        }
+    }
+
+    // the mapping stays for the life of the process
+    setLUT(nsoln, offset, (struct csoln *) (offset + h.ngroups));
+    return 1;
+}
+
+// Best effort; if the image can't be written we just parse again next time.
+static void writeLUTImage(const struct lut_header *sources, int ngroups, int *nsoln, int *offset, struct csoln *soln, int nsolns)
+{
+    struct lut_header h;
+    char path[LUTPATHSIZE], tmp[LUTPATHSIZE + 16];
+    FILE *fp;
+    int ok;
+
+    h = *sources;
+    memcpy(h.magic, LUTMAGIC, sizeof(h.magic));
+    h.version = LUTVERSION;
+    h.d = D;
+    h.routing = ROUTING;
+    h.solnsize = sizeof(struct csoln);
+    h.ngroups = ngroups;
+    h.nsolns = nsolns;
+
+    // write elsewhere and rename, so nobody maps a half-written image
+    lutImagePath(path);
+    sprintf(tmp, "%s.%d", path, (int) getpid());
+    fp = fopen(tmp, "wb");
+    if (fp == NULL)
+        return;
+    ok = fwrite(&h, sizeof(h), 1, fp) == 1
+        && fwrite(nsoln, sizeof(int), ngroups, fp) == (size_t) ngroups
+        && fwrite(offset, sizeof(int), ngroups, fp) == (size_t) ngroups
+        && fwrite(soln, sizeof(struct csoln), nsolns, fp) == (size_t) nsolns;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp, path) != 0)
+        remove(tmp);
+}
+
+// Parses POWV9.dat (and POST9.dat) into one block of solutions.
+static void readLUTText(int *nsoln, int *offset, struct csoln **soln, int *nsolns)
 {
     unsigned char charnum[256], line[32], *linep, c;
     FILE *fpwv, *fprt;
     struct csoln *p;
-    int d, i, j, k, kk, ns, nn;
+    int d, g, i, j, k, kk, ns, nn, total, cap;
 
-    init_param();
-    
     for (i=0; i<=255; i++) {
         if ('0'<=i && i<='9')
             charnum[i] = i - '0';
@@ -81,24 +275,35 @@ void readLUT()
     }
 #endif
 
+    total = 0;
+    cap = 1<<16;
+    *soln = (struct csoln *) calloc(cap, sizeof(struct csoln));
+
+    g = 0;
     for (d=4; d<=D; d++) {
         fscanf(fpwv, "d=%d\n", &d);
 #if ROUTING==1
         fscanf(fprt, "d=%d\n", &d);
 #endif
-        for (k=0; k<numgrp[d]; k++) {
+        for (k=0; k<numgrp[d]; k++, g++) {
             ns = (int) charnum[fgetc(fpwv)];
 
             if (ns==0) {  // same as some previous group
                 fscanf(fpwv, "%d\n", &kk);
-                numsoln[d][k] = numsoln[d][kk];
-                LUT[d][k] = LUT[d][kk];
+                nsoln[g] = nsoln[g-k+kk];
+                offset[g] = offset[g-k+kk];
             }
             else {
                 fgetc(fpwv);  // '\n'
-                numsoln[d][k] = ns;
-                p = (struct csoln*) malloc(ns*sizeof(struct csoln));
-                LUT[d][k] = p;
+                nsoln[g] = ns;
+                offset[g] = total;
+                while (total + ns > cap) {
+                    *soln = (struct csoln *) realloc(*soln, 2*cap*sizeof(struct csoln));
+                    memset(*soln + cap, 0, cap*sizeof(struct csoln));
+                    cap *= 2;
+                }
+                p = *soln + total;
+                total += ns;
                 for (i=1; i<=ns; i++) {
                     linep = (unsigned char *) fgets((char *) line, 32, fpwv);
                     p->parent = charnum[*(linep++)];
@@ -125,6 +330,12 @@ void readLUT()
             }
         }
     }
+
+    fclose(fpwv);
+#if ROUTING==1
+    fclose(fprt);
+#endif
+    *nsolns = total;
 }
 
 DTYPE flute_wl(int d, DTYPE x[], DTYPE y[], int acc)
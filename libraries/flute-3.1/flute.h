@@ -28,8 +28,14 @@
 /*************************************/
 /* Internal Parameters and Functions */
 /*************************************/
+#ifndef POWVFILE
 #define POWVFILE "POWV9.dat"        // LUT for POWV (Wirelength Vector)
+#endif
+#ifndef POSTFILE
 #define POSTFILE "POST9.dat"        // LUT for POST (Steiner Tree)
+#endif
+#define LUTFILE "FLUTE9.lut"        // Binary image of both, made on first run
+                                    // in the directory of POWVFILE
 #define D 9                         // LUT is used for d <= D, D <= 9
 #define TAU(A) (8+1.3*(A))
 #define D1(A) (25+120/((A)*(A)))     // flute_mr is used for D1 < d <= D2
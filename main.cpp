@@ -1,22 +1,50 @@
 // ECE556 - Copyright 2014 University of Wisconsin-Madison.  All Rights Reserved.
 
+#include <chrono>
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <string.h>
 
 #include "ece556.h"
 #include "svg.h"
+#include "parallel.h"
 
-using std::ifstream;
 using std::ofstream;
 using std::cout;
 using std::cerr;
 using std::endl;
 
+// Keep a binary snapshot of each benchmark next to it (<benchmark>.cache)
+// so repeated runs skip the text parse. Off unless built with
+// `make BENCHMARK_CACHE=1`, since it writes beside the input.
+#ifndef BENCHMARK_CACHE
+#define BENCHMARK_CACHE 0
+#endif
+const bool useBenchmarkCache = BENCHMARK_CACHE;
+
+// Overlap writing the output with rip-up and reroute (needs a spare core)
+const bool useOutputPrefetch = true;
+
+bool has_suffix(const char *str, const char *suffix) {
+    size_t len = strlen(str);
+    size_t suffixLen = strlen(suffix);
+    return len > suffixLen && strcmp(str + len - suffixLen, suffix) == 0;
+}
+
 int main(int argc, char **argv)
 {
     time_t start_time = time(nullptr);
 
 
+    /// Decode a compressed output back to text: -decode <routed_file> <text_file>
+    if (argc == 4 && strcmp(argv[1], "-decode") == 0) {
+        ofstream out(argv[3], std::ios::binary);
+        decodeOutput(argv[2], out);
+        return 0;
+    }
+
+
     /// Validate arguments
     if(argc!=5){
         printf("Usage : %s -d=[0-1] -n=[0-1] <input_benchmark_name> <output_file_name> \n", argv[0]);
@@ -58,22 +86,35 @@ int main(int argc, char **argv)
     }
 
 
+    // FLUTE's tables don't depend on the benchmark, so get them going now
+    startLoadingFlute();
+
+
     // Here's a time macro for timing things!
-    clock_t dt;
-    #define TIME(cmd) do {clock_t time = clock(); cmd; dt = clock() - time;} while(0)
+    // Wall clock, since parsing, routing and output all use other threads too
+    long long dt; // ms
+    #define TIME(cmd) do {auto start = std::chrono::steady_clock::now(); cmd; \
+        dt = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();} while(0)
 
 
     /// create a new routing instance
     RoutingInst rst;
 
 
-	/// Read in the benchmark
-    ifstream in(inputFileName);
+	/// Read in the benchmark, or its binary snapshot if we've seen it before
+    std::string cacheFileName = std::string(inputFileName) + ".cache";
+    bool cached = false;
+    if (useBenchmarkCache)
+        TIME(cached = readBenchmarkCache(cacheFileName.c_str(), inputFileName, rst));
 
-    TIME(readBenchmark(in, rst));
-    cout << "Read " << rst.numNets << " nets into " << rst.numCells << " cells in " << (dt * 1000)/CLOCKS_PER_SEC << " ms." << endl;
-
-    in.close();
+    if (!cached) {
+        TIME(readBenchmark(inputFileName, rst));
+        if (useBenchmarkCache)
+            writeBenchmarkCache(cacheFileName.c_str(), inputFileName, rst);
+    }
+    cout << "Read " << rst.numNets << " nets into " << rst.numCells << " cells in " << dt << " ms"
+         << (cached ? " (from cache)." : ".") << endl;
+    reportMemory("parse", rst);
 
 
     /// Run actual routing
@@ -81,8 +122,13 @@ int main(int argc, char **argv)
     if (useNetOrdering)
         end_time += 30*60; // add 30 minutes max for RUARR (it will stop 1 minutes early if possible)
 
-    TIME(solveRouting(rst, end_time, !applyNetDecomp));
-    cout << "Routed in " << (dt * 1000)/CLOCKS_PER_SEC << " ms." << endl;
+    // serialize the nets that are done while the last RUARR iteration runs
+    OutputPrefetch prefetch;
+    OutputPrefetch *pPrefetch = (useOutputPrefetch && hardware_threads() > 1) ? &prefetch : nullptr;
+
+    TIME(solveRouting(rst, end_time, !applyNetDecomp, pPrefetch));
+    cout << "Routed in " << dt << " ms (" << EdgeState::layout_name() << " edge layout, " << EDGE_COUNTER_BITS << "-bit counters, "
+         << GridIndex::scheme_name() << " grid)." << endl;
 
 
 #ifndef NDEBUG
@@ -92,11 +138,17 @@ int main(int argc, char **argv)
 #endif
 
 
-    /// Write the result
-    ofstream out(outputFileName);
+    /// Write the result, in whatever format the output file name asks for
+    OutputFormat format = OUTPUT_TEXT;
+    if (has_suffix(outputFileName, ".gz"))
+        format = OUTPUT_GZIP;
+    else if (has_suffix(outputFileName, ".rbin"))
+        format = OUTPUT_BINARY;
+    ofstream out(outputFileName, std::ios::binary);
 
-    TIME(writeOutput(out, rst));
-    cout << "Wrote output in " << (dt * 1000)/CLOCKS_PER_SEC << " ms." << endl;
+    TIME(writeOutput(out, rst, pPrefetch, format));
+    cout << "Wrote output in " << dt << " ms." << endl;
+    reportMemory("output", rst, nullptr, pPrefetch);
 
     printf("\nDONE!\n");
     exit(0); // Fuck RAII
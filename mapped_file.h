@@ -0,0 +1,76 @@
+//
+// Read-only memory map of an entire file.
+//
+
+#ifndef SILICON_MAPPED_FILE_H
+#define SILICON_MAPPED_FILE_H
+
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct MappedFile {
+    const char *data = nullptr;
+    size_t size = 0;
+
+    MappedFile() {}
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Returns false if the file can't be opened or isn't mappable (pipes, etc.)
+    // A writable map is private copy-on-write; nothing goes back to the file.
+    inline bool open(const char *filename, bool writable = false) {
+        close();
+
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            ::close(fd);
+            return false;
+        }
+
+        size = size_t(st.st_size);
+        if (size == 0) {
+            // mmap refuses zero-length maps, but an empty file is still a file.
+            ::close(fd);
+            data = "";
+            return true;
+        }
+
+        int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+        void *addr = mmap(nullptr, size, prot, MAP_PRIVATE, fd, 0);
+        ::close(fd); // the mapping keeps its own reference
+        if (addr == MAP_FAILED) {
+            size = 0;
+            return false;
+        }
+
+        madvise(addr, size, MADV_SEQUENTIAL);
+        data = static_cast<const char *>(addr);
+        return true;
+    }
+
+    // Keeps the mapping alive for the rest of the process.
+    inline void release() {
+        data = nullptr;
+        size = 0;
+    }
+
+    inline void close() {
+        if (data != nullptr && size != 0) {
+            munmap(const_cast<char *>(data), size);
+        }
+        data = nullptr;
+        size = 0;
+    }
+
+    ~MappedFile() {
+        close();
+    }
+};
+
+#endif //SILICON_MAPPED_FILE_H
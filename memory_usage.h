@@ -0,0 +1,44 @@
+//
+// Resident memory of this process, as the kernel sees it.
+//
+
+#ifndef SILICON_MEMORY_USAGE_H
+#define SILICON_MEMORY_USAGE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+/**
+ * Current and peak resident set size, in kB. Both come from
+ * /proc/self/status; if that can't be read, the peak falls back to
+ * getrusage and the current size is -1.
+ */
+struct ProcessMemory {
+    long rss_kb = -1;
+    long peak_rss_kb = -1;
+
+    static inline ProcessMemory get() {
+        ProcessMemory mem;
+        FILE *f = fopen("/proc/self/status", "r");
+        if (f != nullptr) {
+            char line[256];
+            while (fgets(line, sizeof(line), f) != nullptr) {
+                if (strncmp(line, "VmRSS:", 6) == 0) {
+                    mem.rss_kb = strtol(line + 6, nullptr, 10);
+                } else if (strncmp(line, "VmHWM:", 6) == 0) {
+                    mem.peak_rss_kb = strtol(line + 6, nullptr, 10);
+                }
+            }
+            fclose(f);
+        }
+        if (mem.peak_rss_kb < 0) {
+            struct rusage usage;
+            if (getrusage(RUSAGE_SELF, &usage) == 0) mem.peak_rss_kb = usage.ru_maxrss; // kB on Linux
+        }
+        return mem;
+    }
+};
+
+#endif //SILICON_MEMORY_USAGE_H
@@ -0,0 +1,58 @@
+//
+// Bare-bones fork/join helpers on top of std::thread.
+//
+
+#ifndef SILICON_PARALLEL_H
+#define SILICON_PARALLEL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline int hardware_threads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : int(n);
+}
+
+// Calls fn(t) for t in [0, count), each on its own thread, and waits for all of them.
+// The calling thread runs fn(0) itself so count == 1 never spawns anything.
+template<typename F>
+void run_threads(int count, F fn) {
+    std::vector<std::thread> workers;
+    workers.reserve(count > 1 ? count - 1 : 0);
+    for (int t = 1; t < count; t++) {
+        workers.emplace_back(fn, t);
+    }
+    fn(0);
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+// Holds each of count threads in wait() until all of them get there. Reusable.
+class Barrier {
+public:
+    explicit Barrier(int count) : count(count) {}
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        int gen = generation;
+        if (++arrived == count) {
+            arrived = 0;
+            generation++;
+            all_arrived.notify_all();
+            return;
+        }
+        all_arrived.wait(lock, [this, gen]() { return generation != gen; });
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable all_arrived;
+    int count;
+    int arrived = 0;
+    int generation = 0;
+};
+
+#endif //SILICON_PARALLEL_H
@@ -0,0 +1,79 @@
+//
+// Hardware event counting for the calling thread, through perf_event_open.
+//
+
+#ifndef SILICON_PERF_COUNTER_H
+#define SILICON_PERF_COUNTER_H
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/**
+ * Counts one hardware event while enabled, summed over every start/stop.
+ * Plenty of machines won't let us (containers, perf_event_paranoid, VMs
+ * without a PMU), so open() failing is normal and error() says why.
+ */
+class PerfCounter {
+public:
+    PerfCounter() {}
+    PerfCounter(const PerfCounter &) = delete;
+    PerfCounter &operator=(const PerfCounter &) = delete;
+
+    // Data TLB misses on loads, in user space
+    inline bool open_dtlb_load_misses() {
+        return open(PERF_TYPE_HW_CACHE,
+                    PERF_COUNT_HW_CACHE_DTLB |
+                    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    }
+
+    inline bool is_open() const {
+        return fd >= 0;
+    }
+    inline const char *error() const {
+        return open_errno == 0 ? "not opened" : strerror(open_errno);
+    }
+
+    inline void start() {
+        if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    inline void stop() {
+        if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    // -1 if the counter isn't open
+    inline long long count() const {
+        long long value;
+        if (fd < 0 || ::read(fd, &value, sizeof(value)) != sizeof(value)) return -1;
+        return value;
+    }
+
+    ~PerfCounter() {
+        if (fd >= 0) close(fd);
+    }
+
+private:
+    inline bool open(uint32_t type, uint64_t config) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        open_errno = fd < 0 ? errno : 0;
+        return fd >= 0;
+    }
+
+    int fd = -1;
+    int open_errno = 0;
+};
+
+#endif //SILICON_PERF_COUNTER_H
@@ -0,0 +1,128 @@
+//
+// Slab allocator for the small arrays that hang off a RoutingInst.
+//
+
+#ifndef SILICON_POOL_H
+#define SILICON_POOL_H
+
+#include <stddef.h>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Serves pins, segments and edge arrays out of big slabs instead of one
+ * heap allocation each. Freed arrays go on a free list for their size class
+ * and are handed out again, so rip-up and reroute recycles its own memory.
+ * Not thread safe.
+ */
+class Pool {
+public:
+    Pool() {}
+    Pool(const Pool &) = delete;
+    Pool &operator=(const Pool &) = delete;
+
+    ~Pool() {
+        for (char *slab : slabs) {
+            delete [] slab;
+        }
+    }
+
+    // Returns nullptr for empty arrays. Elements are default-initialized.
+    template<typename T>
+    T *alloc(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "pool memory is never destructed");
+        if (count == 0) return nullptr;
+
+        T *array = static_cast<T *>(alloc_bytes(count * sizeof(T)));
+        for (size_t c = 0; c < count; c++) {
+            new (array + c) T;
+        }
+        return array;
+    }
+
+    // count must be what the array was allocated with
+    template<typename T>
+    void free(T *array, size_t count) {
+        if (array == nullptr) return;
+        free_bytes(array, count * sizeof(T));
+    }
+
+    // Memory taken from the heap: every slab, plus arrays too big to pool
+    inline size_t reserved_bytes() const {
+        return slabs.size() * SLAB_SIZE + big_bytes;
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    static const size_t SLAB_SIZE = 1 << 20;
+    static const size_t SMALL_STEP = 8;   // small classes are every 8 bytes up to SMALL_MAX
+    static const size_t SMALL_MAX = 256;
+    static const size_t MAX_POOLED = 64 << 10; // bigger than this goes straight to the heap
+    static const int NUM_SMALL = SMALL_MAX / SMALL_STEP;
+    static const int NUM_CLASSES = NUM_SMALL + 8; // then powers of two, 512 .. 64K
+
+    // rounds bytes up to the size of its class
+    static inline int size_class(size_t &bytes) {
+        if (bytes <= SMALL_MAX) {
+            bytes = (bytes + SMALL_STEP - 1) & ~(SMALL_STEP - 1);
+            return int(bytes / SMALL_STEP) - 1;
+        }
+        int cls = NUM_SMALL;
+        size_t rounded = SMALL_MAX * 2;
+        while (rounded < bytes) {
+            rounded <<= 1;
+            cls++;
+        }
+        bytes = rounded;
+        return cls;
+    }
+
+    void *alloc_bytes(size_t bytes) {
+        if (bytes > MAX_POOLED) {
+            big_bytes += bytes;
+            return ::operator new(bytes);
+        }
+
+        int cls = size_class(bytes);
+        if (free_lists[cls] != nullptr) {
+            FreeBlock *block = free_lists[cls];
+            free_lists[cls] = block->next;
+            return block;
+        }
+
+        if (cursor == nullptr || size_t(limit - cursor) < bytes) {
+            // the tail of the old slab is abandoned, at most MAX_POOLED of 1MB
+            cursor = new char[SLAB_SIZE];
+            limit = cursor + SLAB_SIZE;
+            slabs.push_back(cursor);
+        }
+        void *mem = cursor;
+        cursor += bytes;
+        return mem;
+    }
+
+    void free_bytes(void *mem, size_t bytes) {
+        if (bytes > MAX_POOLED) {
+            big_bytes -= bytes;
+            ::operator delete(mem);
+            return;
+        }
+
+        int cls = size_class(bytes);
+        FreeBlock *block = static_cast<FreeBlock *>(mem);
+        block->next = free_lists[cls];
+        free_lists[cls] = block;
+    }
+
+    FreeBlock *free_lists[NUM_CLASSES] = {};
+    std::vector<char *> slabs;
+    char *cursor = nullptr;
+    char *limit = nullptr;
+    size_t big_bytes = 0;
+};
+
+#endif //SILICON_POOL_H
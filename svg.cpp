@@ -42,12 +42,11 @@ int writeCongestionSvg(const RoutingInst &inst, const char *filename) {
 
     for (int y = 0; y < inst.gy; y++) {
         for (int x = 0; x < inst.gx; x++) {
-            const Cell &util = inst.util(x, y);
             if (x < inst.gx - 1) {
-                overflow += writeGridLine(f, x, y, x+1, y, util.right, inst.cap);
+                overflow += writeGridLine(f, x, y, x+1, y, inst.util(inst.edge_index(x, y, true)), inst.cap);
             }
             if (y < inst.gy - 1) {
-                overflow += writeGridLine(f, x, y, x, y+1, util.down, inst.cap);
+                overflow += writeGridLine(f, x, y, x, y+1, inst.util(inst.edge_index(x, y, false)), inst.cap);
             }
         }
     }